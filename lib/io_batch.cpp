@@ -0,0 +1,403 @@
+/*
+ *  Batched I/O header definitions
+ *  Submits a group of sysfs reads or writes at once
+ *
+ *  File: io_batch.cpp
+ *  Author: b4fThrive
+ *  Copyright (c) 2020 b4f.thrive@gmail.com
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include "io_batch.h"
+#include "fanControlConfig.h"
+#include "utils.h"
+
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+#ifdef FANCONTROL_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+using namespace std;
+
+namespace utils {
+
+#ifdef FANCONTROL_IO_URING
+
+/**
+ * Minimal io_uring instance. Only the pieces needed by IoBatch, so it doesn't
+ * depend on liburing.
+ *
+ * @struct utils::IoRing
+ */
+struct IoRing {
+  int      fd;      // Ring file descriptor
+  unsigned entries; // Submission queue entries
+
+  void *    sqPtr;   // Submission queue ring mapping
+  size_t    sqSize;  // Submission queue ring mapping size
+  unsigned *sqTail;  // Submission queue tail
+  unsigned *sqMask;  // Submission queue mask
+  unsigned *sqArray; // Submission queue index array
+
+  io_uring_sqe *sqes;     // Submission queue entries
+  size_t        sqesSize; // Submission queue entries mapping size
+
+  void *        cqPtr;  // Completion queue ring mapping
+  size_t        cqSize; // Completion queue ring mapping size
+  unsigned *    cqHead; // Completion queue head
+  unsigned *    cqTail; // Completion queue tail
+  unsigned *    cqMask; // Completion queue mask
+  io_uring_cqe *cqes;   // Completion queue entries
+
+  vector<iovec> iovs; // One iovec per submission queue entry
+};
+
+static void ringFree(IoRing *ring) {
+  if (!ring) return;
+
+  if (ring->sqes) munmap(ring->sqes, ring->sqesSize);
+  if (ring->cqPtr && ring->cqPtr != ring->sqPtr)
+    munmap(ring->cqPtr, ring->cqSize);
+  if (ring->sqPtr) munmap(ring->sqPtr, ring->sqSize);
+  if (ring->fd >= 0) close(ring->fd);
+
+  delete ring;
+}
+
+/**
+ * Creates and maps an io_uring instance
+ *
+ * @param  {unsigned} entries : Submission queue size
+ *
+ * @return {IoRing*}          : The ring or nullptr if io_uring is unavailable
+ */
+static IoRing *ringSetup(unsigned entries) {
+  io_uring_params params;
+  IoRing *        ring = new IoRing();
+
+  memset(&params, 0, sizeof(params));
+  ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+
+  if (ring->fd < 0) {
+    delete ring;
+    return nullptr;
+  }
+
+  ring->entries = params.sq_entries;
+  ring->sqSize  = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+    ring->sqSize = ring->cqSize = max(ring->sqSize, ring->cqSize);
+
+  ring->sqPtr = mmap(0, ring->sqSize, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sqPtr == MAP_FAILED) {
+    ring->sqPtr = nullptr;
+    ringFree(ring);
+    return nullptr;
+  }
+
+  if (params.features & IORING_FEAT_SINGLE_MMAP) ring->cqPtr = ring->sqPtr;
+  else {
+    ring->cqPtr = mmap(0, ring->cqSize, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cqPtr == MAP_FAILED) {
+      ring->cqPtr = nullptr;
+      ringFree(ring);
+      return nullptr;
+    }
+  }
+
+  ring->sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+  ring->sqes     = (io_uring_sqe *)mmap(0, ring->sqesSize,
+                                    PROT_READ | PROT_WRITE,
+                                    MAP_SHARED | MAP_POPULATE,
+                                    ring->fd,
+                                    IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) {
+    ring->sqes = nullptr;
+    ringFree(ring);
+    return nullptr;
+  }
+
+  char *sq      = (char *)ring->sqPtr;
+  char *cq      = (char *)ring->cqPtr;
+  ring->sqTail  = (unsigned *)(sq + params.sq_off.tail);
+  ring->sqMask  = (unsigned *)(sq + params.sq_off.ring_mask);
+  ring->sqArray = (unsigned *)(sq + params.sq_off.array);
+  ring->cqHead  = (unsigned *)(cq + params.cq_off.head);
+  ring->cqTail  = (unsigned *)(cq + params.cq_off.tail);
+  ring->cqMask  = (unsigned *)(cq + params.cq_off.ring_mask);
+  ring->cqes    = (io_uring_cqe *)(cq + params.cq_off.cqes);
+
+  ring->iovs.resize(ring->entries);
+
+  return ring;
+}
+
+#else
+
+struct IoRing {
+  unsigned entries; // Never created without io_uring
+};
+
+static void    ringFree(IoRing *ring) { delete ring; }
+static IoRing *ringSetup(unsigned entries) { return nullptr; }
+
+#endif
+
+/**
+ * Batched I/O class constructor.
+ *
+ * @class  utils::IoBatch
+ * @public IoBatch::IoBatch
+ *
+ * @param  {unsigned int} entries : io_uring queue size, 0 disables io_uring
+ */
+IoBatch::IoBatch(unsigned int entries)
+    : ring(entries > 0 ? ringSetup(entries) : nullptr) {}
+IoBatch::~IoBatch() { ringFree(ring); }
+
+bool IoBatch::usingRing() const { return ring != nullptr; }
+int  IoBatch::size() const { return ops.size(); }
+
+/**
+ * Batched I/O class function. Queues a read at offset 0.
+ *
+ * @class  utils::IoBatch
+ * @public IoBatch::addRead
+ *
+ * @param  {SysfsFile*} file : File to read
+ * @param  {char*}      buf  : Where to store the content
+ * @param  {size_t}     size : Buffer size
+ *
+ * @return {int}             : Operation index, used to get the result
+ */
+int IoBatch::addRead(SysfsFile *file, char *buf, size_t size) {
+  Op op = {file, buf, size, false, -EAGAIN};
+  ops.push_back(op);
+  return ops.size() - 1;
+}
+
+/**
+ * Batched I/O class function. Queues a write at offset 0.
+ *
+ * @class  utils::IoBatch
+ * @public IoBatch::addWrite
+ *
+ * @param  {SysfsFile*}  file : File to write
+ * @param  {const char*} buf  : Content to write
+ * @param  {size_t}      size : Content size
+ *
+ * @return {int}              : Operation index, used to get the result
+ */
+int IoBatch::addWrite(SysfsFile *file, const char *buf, size_t size) {
+  Op op = {file, (char *)buf, size, true, -EAGAIN};
+  ops.push_back(op);
+  return ops.size() - 1;
+}
+
+/**
+ * Batched I/O class function. Submits all queued operations and waits for
+ * them. Operations failed because the device was gone are retried one by one
+ * so the file can be reopened.
+ *
+ * @class  utils::IoBatch
+ * @public IoBatch::submit
+ */
+void IoBatch::submit() {
+  size_t opsSize = ops.size();
+
+  for (size_t from = 0; from < opsSize;) {
+    size_t count = ring ? min(opsSize - from, (size_t)ring->entries)
+                        : opsSize - from;
+
+    if (ring) submitRing(from, count);
+    else
+      submitSync(from, count);
+
+    from += count;
+  }
+
+  for (size_t i = 0; i < opsSize; i++)
+    if (ops[i].res == -ENODEV || ops[i].res == -ENOENT ||
+        ops[i].res == -EBADF)
+      submitSync(i, 1);
+}
+
+void IoBatch::clear() { ops.clear(); }
+
+/**
+ * Batched I/O class getter.
+ *
+ * @class  utils::IoBatch
+ * @public IoBatch::result
+ *
+ * @param  {int} index : Operation index
+ *
+ * @return {ssize_t}   : Bytes transferred or -errno
+ */
+ssize_t IoBatch::result(int index) const { return ops[index].res; }
+
+/**
+ * Batched I/O class function. Plain syscalls fallback.
+ *
+ * @class   utils::IoBatch
+ * @private IoBatch::submitSync
+ *
+ * @param  {size_t} from  : First operation
+ * @param  {size_t} count : Number of operations
+ */
+void IoBatch::submitSync(size_t from, size_t count) {
+  for (size_t i = from; i < from + count; i++) {
+    Op &op = ops[i];
+
+    // Unbound or gone device, errno could be anything left over
+    if (op.file->getFd() < 0) {
+      op.res = -ENODEV;
+      continue;
+    }
+
+    errno = 0;
+
+    // A short write sets no errno
+    if (op.write)
+      op.res = op.file->write(op.buf, op.size) ? op.size
+                                               : -(errno ? errno : EIO);
+    else if ((op.res = op.file->read(op.buf, op.size)) < 0)
+      op.res = -(errno ? errno : EIO);
+  }
+}
+
+/**
+ * Batched I/O class function. Submits the operations on one io_uring call and
+ * reaps all the completions.
+ *
+ * @class   utils::IoBatch
+ * @private IoBatch::submitRing
+ *
+ * @param  {size_t} from  : First operation
+ * @param  {size_t} count : Number of operations, at most the ring size
+ */
+void IoBatch::submitRing(size_t from, size_t count) {
+#ifdef FANCONTROL_IO_URING
+  unsigned tail    = *ring->sqTail;
+  unsigned queued  = 0;
+  unsigned pending = 0;
+
+  for (size_t i = from; i < from + count; i++) {
+    Op &     op  = ops[i];
+    int      fd  = op.file->getFd();
+    unsigned idx = tail & *ring->sqMask;
+
+    if (fd < 0) {
+      op.res = -ENODEV;
+      continue;
+    }
+
+    io_uring_sqe *sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+
+    ring->iovs[idx].iov_base = op.buf;
+    ring->iovs[idx].iov_len  = op.size;
+
+    sqe->opcode    = op.write ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd        = fd;
+    sqe->addr      = (unsigned long)&ring->iovs[idx];
+    sqe->len       = 1;
+    sqe->off       = 0;
+    sqe->user_data = i;
+
+    ring->sqArray[idx] = idx;
+    tail++;
+    queued++;
+  }
+
+  if (queued == 0) return;
+
+  __atomic_store_n(ring->sqTail, tail, __ATOMIC_RELEASE);
+
+  unsigned toSubmit = queued;
+  pending           = queued;
+
+  while (pending > 0) {
+    int res = syscall(__NR_io_uring_enter,
+                      ring->fd,
+                      toSubmit,
+                      pending,
+                      IORING_ENTER_GETEVENTS,
+                      nullptr,
+                      0);
+
+    if (res < 0) {
+      if (errno == EINTR) continue;
+
+      // The ring is broken, the entries it never took finish with plain
+      // syscalls. The submitted ones aren't run twice, they are awaited so
+      // the kernel is done with the iovecs before the ring is freed.
+      for (unsigned left = toSubmit; left > 0; left--)
+        submitSync(ring->sqes[(tail - left) & *ring->sqMask].user_data, 1);
+
+      pending -= toSubmit;
+      while ((pending -= reapRing()) > 0)
+        if (syscall(__NR_io_uring_enter, ring->fd, 0, 1,
+                    IORING_ENTER_GETEVENTS, nullptr, 0) < 0 &&
+            errno != EINTR)
+          break;
+
+      // Leaked if they can't be awaited, freeing it could corrupt memory
+      if (pending == 0) ringFree(ring);
+      ring = nullptr;
+      return;
+    }
+
+    toSubmit -= min((unsigned)res, toSubmit);
+    pending -= reapRing();
+  }
+#else
+  submitSync(from, count);
+#endif
+}
+
+/**
+ * Batched I/O class function. Takes the results of the completed io_uring
+ * operations. A short write is a failure, like SysfsFile::write.
+ *
+ * @class   utils::IoBatch
+ * @private IoBatch::reapRing
+ *
+ * @return {unsigned} : Number of operations completed
+ */
+unsigned IoBatch::reapRing() {
+  unsigned reaped = 0;
+
+#ifdef FANCONTROL_IO_URING
+  unsigned head = *ring->cqHead;
+
+  while (head != __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)) {
+    io_uring_cqe *cqe = &ring->cqes[head & *ring->cqMask];
+    Op &          op  = ops[cqe->user_data];
+
+    op.res = op.write && cqe->res >= 0 && (size_t)cqe->res != op.size
+                 ? -EIO
+                 : cqe->res;
+    head++;
+    reaped++;
+  }
+  __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+#endif
+
+  return reaped;
+}
+
+} // namespace utils
@@ -0,0 +1,70 @@
+/*
+ *  Batched I/O header declarations
+ *  Submits a group of sysfs reads or writes at once
+ *
+ *  File: io_batch.h
+ *  Author: b4fThrive
+ *  Copyright (c) 2020 b4f.thrive@gmail.com
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#ifndef _IO_BATCH_
+#define _IO_BATCH_
+
+#include <iostream>
+#include <vector>
+
+#include "utils.h"
+
+using namespace std;
+
+namespace utils {
+
+struct IoRing; // io_uring instance, only defined when built with io_uring
+
+/**
+ * Batched I/O class.
+ * Queues pread/pwrite operations at offset 0 on SysfsFile objects and submits
+ * them together. Uses one io_uring submission when available and falls back
+ * to plain syscalls otherwise.
+ *
+ * @class utils::IoBatch
+ */
+class IoBatch {
+private:
+  struct Op {
+    SysfsFile *file;  // File to read or write
+    char *     buf;   // Data buffer
+    size_t     size;  // Buffer size
+    bool       write; // Write operation if true
+    ssize_t    res;   // Result, bytes transferred or -errno
+  };
+
+  vector<Op> ops;  // Queued operations
+  IoRing *   ring; // io_uring instance or nullptr
+
+  void     submitRing(size_t, size_t);
+  void     submitSync(size_t, size_t);
+  unsigned reapRing();
+
+public:
+  IoBatch(unsigned int = 64);
+  ~IoBatch();
+
+  bool usingRing() const;
+  int  size() const;
+
+  int addRead(SysfsFile *, char *, size_t);
+  int addWrite(SysfsFile *, const char *, size_t);
+
+  void    submit();
+  void    clear();
+  ssize_t result(int) const;
+};
+
+} // namespace utils
+
+#endif /* _IO_BATCH_ */
@@ -13,9 +13,20 @@
 
 #include "utils.h"
 
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
 #include <cstdio>
+#include <dirent.h>
 #include <fstream>
+#include <poll.h>
+#include <spawn.h>
+#include <stdexcept>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
 #include <unistd.h>
 
 using namespace std;
@@ -52,6 +63,90 @@ string readFile(string path, bool no_throw) {
   return result;
 }
 
+/**
+ * Open file relative to a directory descriptor and return first line
+ *
+ * @param  {int}    dirFd    : Directory file descriptor
+ * @param  {string} name     : File name relative to dirFd
+ * @param  {bool}   no_throw : Returns "" instead of throwing on errors
+ * @return {string}          : Return first line from file
+ */
+string readFileAt(int dirFd, string name, bool no_throw) {
+  char    buf[256];
+  int     fd  = openat(dirFd, name.c_str(), O_RDONLY | O_CLOEXEC);
+  ssize_t res = fd < 0 ? -1 : pread(fd, buf, sizeof(buf), 0);
+
+  if (fd >= 0) close(fd);
+
+  if (res < 0) {
+    if (!no_throw) throw runtime_error("Can't open file " + name);
+    return "";
+  }
+
+  string result(buf, res);
+  size_t eol = result.find('\n');
+
+  return eol == string::npos ? result : result.substr(0, eol);
+}
+
+/**
+ * Lists a directory entries sorted by name, like ls does
+ *
+ * @param  {string} dir    : Directory path
+ * @param  {string} prefix : Only entries starting with prefix
+ * @param  {string} suffix : Only entries ending with suffix
+ * @return {vector<string>} : Entries names
+ */
+vector<string> listDir(string dir, string prefix, string suffix) {
+  int            dirFd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  vector<string> entries;
+
+  if (dirFd >= 0) {
+    entries = listDirAt(dirFd, prefix, suffix);
+    close(dirFd);
+  }
+
+  return entries;
+}
+
+/**
+ * Lists a directory entries sorted by name, like ls does
+ *
+ * @param  {int}    dirFd  : Directory file descriptor, it stays open
+ * @param  {string} prefix : Only entries starting with prefix
+ * @param  {string} suffix : Only entries ending with suffix
+ * @return {vector<string>} : Entries names
+ */
+vector<string> listDirAt(int dirFd, string prefix, string suffix) {
+  vector<string> entries;
+  int            fd  = dup(dirFd);
+  DIR *          dir = fd < 0 ? nullptr : fdopendir(fd);
+  dirent *       entry;
+
+  if (!dir) {
+    if (fd >= 0) close(fd);
+    return entries;
+  }
+
+  rewinddir(dir);
+
+  while ((entry = readdir(dir)) != nullptr) {
+    string name = entry->d_name;
+
+    if (name[0] == '.' || name.size() < prefix.size() + suffix.size() ||
+        name.compare(0, prefix.size(), prefix) != 0 ||
+        name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0)
+      continue;
+
+    entries.push_back(name);
+  }
+
+  closedir(dir);
+  sort(entries.begin(), entries.end());
+
+  return entries;
+}
+
 /**
  * Write a string in a file
  *
@@ -90,6 +185,154 @@ bool appendFile(string path, string content) {
   return true;
 }
 
+/**
+ * Writes a whole buffer to a descriptor, retrying short and interrupted
+ * writes.
+ *
+ * @param  {int}         fd   : File descriptor
+ * @param  {const char*} data : Buffer
+ * @param  {size_t}      size : Buffer size
+ *
+ * @return {bool}             : True if everything was written
+ */
+bool writeAll(int fd, const char *data, size_t size) {
+  while (size > 0) {
+    ssize_t written = ::write(fd, data, size);
+
+    if (written < 0 && errno == EINTR) continue;
+    if (written <= 0) return false;
+
+    data += written;
+    size -= written;
+  }
+
+  return true;
+}
+
+/**
+ * Replaces a file atomically. The content is written to a new temporary
+ * file next to it, created exclusively with mkstemp, and renamed over the
+ * file. fanControl runs as root on user directories, a fixed temporary name
+ * could be a symlink to any file.
+ *
+ * @param  {string} path    : File path
+ * @param  {string} content : New content
+ * @param  {mode_t} mode    : File permissions
+ *
+ * @return {bool}           : True if the file was replaced
+ */
+bool replaceFile(string path, const string &content, mode_t mode) {
+  string       tmpPath = path + ".XXXXXX";
+  vector<char> name(tmpPath.begin(), tmpPath.end());
+
+  name.push_back('\0');
+
+  int fd = mkostemp(&name[0], O_CLOEXEC);
+  if (fd < 0) return false;
+
+  bool saved = fchmod(fd, mode) == 0 &&
+               writeAll(fd, content.data(), content.size());
+
+  saved = close(fd) == 0 && saved && rename(&name[0], path.c_str()) == 0;
+  if (!saved) unlink(&name[0]);
+
+  return saved;
+}
+
+/**
+ * Checks a file can be run by fanControl, it must be owned by root or by the
+ * effective user and must not be writable by group or others. fanControl
+ * runs as root, so user writable helpers or plugins would run as root too.
+ *
+ * @param  {string} path : File path
+ *
+ * @return {bool}        : True if the file is trusted
+ */
+bool isTrusted(string path) {
+  struct stat st;
+
+  if (stat(path.c_str(), &st) < 0 || !S_ISREG(st.st_mode)) return false;
+  if (st.st_uid != 0 && st.st_uid != geteuid()) return false;
+
+  return (st.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+}
+
+// Checks an opened file or directory like isTrusted() does
+static bool isTrustedFd(int fd, bool dir) {
+  struct stat st;
+
+  if (fstat(fd, &st) < 0) return false;
+  if (dir ? !S_ISDIR(st.st_mode) : !S_ISREG(st.st_mode)) return false;
+  if (st.st_uid != 0 && st.st_uid != geteuid()) return false;
+
+  return (st.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+}
+
+/**
+ * Opens a file fanControl can run, it must be directly under dir. The file
+ * and every directory from the root down to it must be trusted, like on
+ * isTrusted(), and none of them can be a symlink. The checks are done on the
+ * opened descriptors, so the caller must run or load the descriptor, never
+ * the path again.
+ *
+ * @param  {string} path : File path
+ * @param  {string} dir  : Absolute directory the file must be in
+ *
+ * @return {int}         : Close on exec descriptor, never a standard one, or
+ *                         -1 if the file is not trusted
+ */
+int openTrusted(string path, string dir) {
+  if (dir.empty() || dir[0] != '/') return -1;
+  checkDir(dir);
+
+  string name = path.compare(0, dir.size(), dir) == 0 ? path.substr(dir.size())
+                                                      : "";
+  string part;
+  int    dirFd, fd;
+
+  if (name == "" || name == "." || name == ".." ||
+      name.find('/') != string::npos)
+    return -1;
+
+  dirFd = open("/", O_PATH | O_DIRECTORY | O_CLOEXEC);
+
+  // Every directory is checked before opening the next one on it
+  for (size_t from = 1, to; dirFd >= 0 && from < dir.size(); from = to + 1) {
+    to   = dir.find('/', from);
+    part = dir.substr(from, to - from);
+    fd   = -1;
+
+    if (isTrustedFd(dirFd, true) && part != "" && part != "." && part != "..")
+      fd = openat(dirFd, part.c_str(),
+                  O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+
+    close(dirFd);
+    dirFd = fd;
+  }
+
+  if (dirFd < 0) return -1;
+
+  fd = isTrustedFd(dirFd, true)
+           ? openat(dirFd, name.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC)
+           : -1;
+  close(dirFd);
+
+  if (fd >= 0 && !isTrustedFd(fd, false)) {
+    close(fd);
+    return -1;
+  }
+
+  // Standard descriptors can be closed on the service, keep them free
+  if (fd >= 0 && fd <= STDERR_FILENO) {
+    int high = fcntl(fd, F_DUPFD_CLOEXEC, STDERR_FILENO + 1);
+
+    close(fd);
+    fd = high;
+  }
+
+  return fd;
+}
+
 // Close standard descriptors
 void closeSTDdescriptors() {
   close(STDIN_FILENO);
@@ -97,7 +340,14 @@ void closeSTDdescriptors() {
   close(STDERR_FILENO);
 }
 
-ShellCommand::ShellCommand(string command) : command(command) { exec(); }
+ShellCommand::ShellCommand(string command, int timeout)
+    : command(command), pos(-1), size(0), timeout(timeout), status(-1) {
+  exec();
+}
+ShellCommand::ShellCommand(const vector<string> &argv, int timeout)
+    : pos(-1), size(0), timeout(timeout), status(-1) {
+  exec(argv);
+}
 ShellCommand::~ShellCommand() {}
 
 /**
@@ -169,60 +419,696 @@ int ShellCommand::currLine() const { return pos; }
  */
 int ShellCommand::getSize() const { return size; }
 
+string ShellCommand::getError() const { return error; }
+string ShellCommand::getStderr() const { return errOutput; }
+int    ShellCommand::getStatus() const { return status; }
+int    ShellCommand::getTimeout() const { return timeout; }
+
+void ShellCommand::setTimeout(int _timeout) { timeout = _timeout; }
+
 /**
  * System shell command class function
- * Exec _command and set it as new command or the command stored if empty
+ * Exec _command and set it as new command or the command stored if empty.
+ * The command runs without shell if it has no shell syntax.
  *
  * @class  utils::ShellCommand
  * @public exec(string _command)
  *
  * @param  {string} _command : Command to execute
  *
- * @return {bool}            : True if done
+ * @return {bool}            : True if the command printed something
  */
 bool ShellCommand::exec(string _command) {
-  lines.clear();
-  size    = 0;
   command = _command != "" ? _command : command;
-  error   = "";
 
   if (command == "") {
+    lines.clear();
+    size  = 0;
+    pos   = -1;
     error = "The commands is empty";
     return false;
   }
 
-  string line;
-  FILE * fsResult = popen(command.c_str(), "r");
+  if (needsShell(command)) return run({"/bin/sh", "-c", command});
+
+  return run(splitArgs(command));
+}
 
-  if (fsResult == NULL) {
+/**
+ * System shell command class function
+ * Exec a command from its arguments, without shell
+ *
+ * @class  utils::ShellCommand
+ * @public exec(const vector<string> &argv)
+ *
+ * @param  {vector<string>} argv : Command and arguments
+ *
+ * @return {bool}                : True if the command printed something
+ */
+bool ShellCommand::exec(const vector<string> &argv) {
+  command = "";
+  for (unsigned int i = 0; i < argv.size(); i++)
+    command += (i > 0 ? " " : "") + argv[i];
+
+  return run(argv);
+}
+
+/**
+ * System shell command class function
+ * Spawns the command, reads stdout and stderr until it exits or the deadline
+ * is reached. Stdout is splitted on lines.
+ *
+ * @class   utils::ShellCommand
+ * @private run(const vector<string> &argv)
+ *
+ * @param  {vector<string>} argv : Command and arguments
+ *
+ * @return {bool}                : True if the command printed something
+ */
+bool ShellCommand::run(const vector<string> &argv) {
+  lines.clear();
+  size      = 0;
+  pos       = -1;
+  status    = -1;
+  error     = "";
+  errOutput = "";
+
+  if (argv.empty()) {
+    error = "The commands is empty";
+    return false;
+  }
+
+  int outPipe[2], errPipe[2];
+
+  if (pipe2(outPipe, O_CLOEXEC) < 0) {
+    error = "Error processing command: " + command;
+    return false;
+  }
+  if (pipe2(errPipe, O_CLOEXEC) < 0) {
+    ::close(outPipe[0]);
+    ::close(outPipe[1]);
     error = "Error processing command: " + command;
     return false;
   }
 
-  char c = fgetc(fsResult);
-  while ((c != -1)) {
-    if (c != '\n') line.push_back(c);
-    else {
-      lines.push_back(line);
-      line = "";
+  vector<char *> args;
+  for (unsigned int i = 0; i < argv.size(); i++)
+    args.push_back(const_cast<char *>(argv[i].c_str()));
+  args.push_back(nullptr);
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+  posix_spawn_file_actions_adddup2(&actions, outPipe[1], 1);
+  posix_spawn_file_actions_adddup2(&actions, errPipe[1], 2);
+
+  // Own process group, so /bin/sh children are killed with it on timeouts
+  posix_spawnattr_t attr;
+  posix_spawnattr_init(&attr);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+  posix_spawnattr_setpgroup(&attr, 0);
+
+  pid_t pid;
+  int   res = posix_spawnp(&pid, args[0], &actions, &attr, &args[0], environ);
+
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+  ::close(outPipe[1]);
+  ::close(errPipe[1]);
+
+  if (res != 0) {
+    ::close(outPipe[0]);
+    ::close(errPipe[0]);
+    error = "Error processing command: " + command;
+    return false;
+  }
+
+  if (buffer.empty()) buffer.resize(65536);
+
+  pollfd fds[2] = {{outPipe[0], POLLIN, 0}, {errPipe[0], POLLIN, 0}};
+  string line;
+  auto   deadline = chrono::steady_clock::now() + chrono::milliseconds(timeout);
+  bool   timedOut = false;
+
+  while (fds[0].fd >= 0 || fds[1].fd >= 0) {
+    auto left = chrono::duration_cast<chrono::milliseconds>(
+        deadline - chrono::steady_clock::now());
+
+    if (left.count() <= 0) {
+      timedOut = true;
+      break;
+    }
+
+    if (poll(fds, 2, left.count()) < 0) {
+      if (errno == EINTR) continue;
+      timedOut = true;
+      break;
+    }
+
+    for (int i = 0; i < 2; i++) {
+      if (fds[i].fd < 0 || !fds[i].revents) continue;
+
+      ssize_t len = ::read(fds[i].fd, &buffer[0], buffer.size());
+
+      if (len < 0 && errno == EINTR) continue;
+      if (len <= 0) {
+        ::close(fds[i].fd);
+        fds[i].fd = -1;
+      } else if (i == 1)
+        errOutput.append(&buffer[0], len);
+      else
+        for (ssize_t j = 0; j < len; j++) {
+          if (buffer[j] != '\n') line.push_back(buffer[j]);
+          else {
+            lines.push_back(line);
+            line = "";
+          }
+        }
+    }
+  }
+
+  if (line != "") lines.push_back(line);
+
+  for (int i = 0; i < 2; i++)
+    if (fds[i].fd >= 0) ::close(fds[i].fd);
+
+  int  wStatus = 0;
+  bool exited  = false;
+
+  // The exit wait has the same deadline, pipes can be closed before it
+  while (!timedOut) {
+    pid_t waited = waitpid(pid, &wStatus, WNOHANG);
+
+    if (waited == pid) {
+      exited = true;
+      break;
     }
-    if ((c = fgetc(fsResult)) == -1 && line != "") lines.push_back(line);
+    if (waited < 0 && errno != EINTR) break;
+
+    if (chrono::steady_clock::now() >= deadline) timedOut = true;
+    else
+      this_thread::sleep_for(chrono::milliseconds(5));
   }
 
-  fclose(fsResult);
+  if (timedOut) kill(-pid, SIGKILL);
+  if (!exited)
+    while (waitpid(pid, &wStatus, 0) < 0 && errno == EINTR) {}
+
+  if (exited && WIFEXITED(wStatus)) status = WEXITSTATUS(wStatus);
 
   size = lines.size();
 
-  if (size == 0) {
-    pos   = -1;
+  if (timedOut) error = "Command timed out: " + command;
+  else if (size == 0)
     error = "Command without any result";
+
+  if (size == 0) return false;
+
+  pos = 0;
+  return true;
+}
+
+/**
+ * System shell command class static function
+ * Checks if a command line uses shell syntax
+ *
+ * @class  utils::ShellCommand
+ * @public needsShell(const string &command)
+ *
+ * @param  {string} command : Command line
+ *
+ * @return {bool}           : True if it must run through /bin/sh
+ */
+bool ShellCommand::needsShell(const string &command) {
+  return command.find_first_of("|&;<>()$`\\\"'*?[]#~=%{}\n") != string::npos;
+}
+
+/**
+ * System shell command class static function
+ * Splits a command line without shell syntax on blanks
+ *
+ * @class  utils::ShellCommand
+ * @public splitArgs(const string &command)
+ *
+ * @param  {string} command : Command line
+ *
+ * @return {vector<string>} : Command arguments
+ */
+vector<string> ShellCommand::splitArgs(const string &command) {
+  vector<string> argv;
+  string         arg;
+
+  for (unsigned int i = 0; i <= command.size(); i++) {
+    if (i == command.size() || command[i] == ' ' || command[i] == '\t') {
+      if (arg != "") argv.push_back(arg);
+      arg = "";
+    } else
+      arg.push_back(command[i]);
+  }
+
+  return argv;
+}
+
+/**
+ * Steady clock milliseconds
+ *
+ * @return {long long} : Milliseconds
+ */
+static long long steadyMs() {
+  return chrono::duration_cast<chrono::milliseconds>(
+             chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+/**
+ * Long lived child process class constructor. The child isn't started until
+ * start() or the first write().
+ *
+ * @class  utils::CoProcess
+ * @public CoProcess::CoProcess
+ *
+ * @param  {vector<string>} argv    : Program and arguments
+ * @param  {int}            timeout : Read deadline in milliseconds
+ */
+CoProcess::CoProcess(const vector<string> &argv, int timeout)
+    : argv(argv), execFd(-1), pid(-1), fd(-1), timeout(timeout), started(0) {}
+CoProcess::~CoProcess() { stop(); }
+
+vector<string> CoProcess::getArgv() const { return argv; }
+string         CoProcess::getError() const { return error; }
+int            CoProcess::getTimeout() const { return timeout; }
+pid_t          CoProcess::getPid() const { return pid; }
+
+void CoProcess::setArgv(const vector<string> &_argv) {
+  stop();
+  argv = _argv;
+}
+void CoProcess::setTimeout(int _timeout) { timeout = _timeout; }
+
+// The descriptor, like the ones from openTrusted(), is not owned
+void CoProcess::setExecFd(int _execFd) {
+  stop();
+  execFd = _execFd;
+}
+
+/**
+ * Long lived child process class function. Reaps the child if it exited.
+ *
+ * @class  utils::CoProcess
+ * @public CoProcess::isRunning
+ *
+ * @return {bool} : True if the child is alive
+ */
+bool CoProcess::isRunning() {
+  if (pid < 0) return false;
+
+  if (waitpid(pid, nullptr, WNOHANG) == pid) {
+    pid = -1;
+    stop();
     return false;
   }
 
-  pos = 0;
   return true;
 }
 
+/**
+ * Long lived child process class function. Spawns the child, stderr goes to
+ * /dev/null.
+ *
+ * @class  utils::CoProcess
+ * @public CoProcess::start
+ *
+ * @return {bool} : True if the child is running
+ */
+bool CoProcess::start() {
+  int sockets[2];
+
+  if (isRunning()) return true;
+
+  if (argv.empty()) {
+    error = "The commands is empty";
+    return false;
+  }
+
+  if (started > 0 && steadyMs() - started < RESTART_DELAY) {
+    error = "Restarted too soon: " + argv[0];
+    return false;
+  }
+
+  started = steadyMs();
+  buffer  = "";
+
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) < 0) {
+    error = "Error starting: " + argv[0];
+    return false;
+  }
+
+  vector<char *> args;
+  for (unsigned int i = 0; i < argv.size(); i++)
+    args.push_back(const_cast<char *>(argv[i].c_str()));
+  args.push_back(nullptr);
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, sockets[1], 0);
+  posix_spawn_file_actions_adddup2(&actions, sockets[1], 1);
+  posix_spawn_file_actions_addopen(&actions, 2, "/dev/null", O_WRONLY, 0);
+
+  // The checked file is run, not whatever the path points to now. Scripts
+  // interpreters open it again through /dev/fd, so it stays open on the child
+  string program = args[0];
+  if (execFd >= 0) {
+    posix_spawn_file_actions_adddup2(&actions, execFd, EXEC_FD);
+    program = "/proc/self/fd/" + to_string(EXEC_FD);
+  }
+
+  int res = posix_spawnp(&pid, program.c_str(), &actions, nullptr, &args[0],
+                         environ);
+
+  posix_spawn_file_actions_destroy(&actions);
+  ::close(sockets[1]);
+
+  if (res != 0) {
+    ::close(sockets[0]);
+    pid   = -1;
+    error = "Error starting: " + argv[0];
+    return false;
+  }
+
+  fd = sockets[0];
+  return true;
+}
+
+/**
+ * Long lived child process class function. Closes the child stdin, and kills
+ * it if it doesn't exit on its own.
+ *
+ * @class  utils::CoProcess
+ * @public CoProcess::stop
+ */
+void CoProcess::stop() {
+  if (fd >= 0) ::close(fd);
+  fd     = -1;
+  buffer = "";
+
+  if (pid < 0) return;
+
+  for (int i = 0; i < 10 && waitpid(pid, nullptr, WNOHANG) == 0; i++)
+    this_thread::sleep_for(chrono::milliseconds(10));
+
+  if (waitpid(pid, nullptr, WNOHANG) == 0) {
+    kill(pid, SIGKILL);
+    while (waitpid(pid, nullptr, 0) < 0 && errno == EINTR) {}
+  }
+
+  pid = -1;
+}
+
+/**
+ * Long lived child process class function. Writes to the child stdin,
+ * starting it if needed.
+ *
+ * @class  utils::CoProcess
+ * @public CoProcess::write
+ *
+ * @param  {string} data : Data to write
+ *
+ * @return {bool}        : True if all the data was written
+ */
+bool CoProcess::write(const string &data) {
+  size_t done = 0;
+
+  if (!start()) return false;
+
+  while (done < data.size()) {
+    ssize_t len =
+        send(fd, data.c_str() + done, data.size() - done, MSG_NOSIGNAL);
+
+    if (len < 0 && errno == EINTR) continue;
+    if (len <= 0) {
+      error = "Error writing to: " + argv[0];
+      stop();
+      return false;
+    }
+
+    done += len;
+  }
+
+  return true;
+}
+
+/**
+ * Long lived child process class function. Reads until a delimiter, the data
+ * after it is kept for the next read. On timeouts or EOF the child is
+ * stopped, its answers can't be trusted anymore.
+ *
+ * @class  utils::CoProcess
+ * @public CoProcess::readUntil
+ *
+ * @param  {string}  delim : Delimiter
+ * @param  {string&} data  : Where to store the data before the delimiter
+ *
+ * @return {bool}          : True if the delimiter was found
+ */
+bool CoProcess::readUntil(const string &delim, string &data) {
+  auto   deadline = chrono::steady_clock::now() + chrono::milliseconds(timeout);
+  size_t found;
+  char   buf[4096];
+
+  while ((found = buffer.find(delim)) == string::npos) {
+    auto left = chrono::duration_cast<chrono::milliseconds>(
+        deadline - chrono::steady_clock::now());
+    pollfd pfd = {fd, POLLIN, 0};
+
+    if (fd < 0 || left.count() <= 0) {
+      error = fd < 0 ? "Not running: " : "Timed out: ";
+      error += argv.empty() ? "" : argv[0];
+      stop();
+      return false;
+    }
+
+    if (poll(&pfd, 1, left.count()) <= 0) continue;
+
+    ssize_t len = ::read(fd, buf, sizeof(buf));
+
+    if (len < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+    if (len <= 0) {
+      error = "Exited: " + argv[0];
+      stop();
+      return false;
+    }
+
+    buffer.append(buf, len);
+  }
+
+  data   = buffer.substr(0, found);
+  buffer = buffer.substr(found + delim.size());
+
+  return true;
+}
+
+bool CoProcess::readLine(string &line) { return readUntil("\n", line); }
+
+/**
+ * Persistent sysfs file constructor. The file is opened on first use.
+ *
+ * @class  utils::SysfsFile
+ * @public SysfsFile::SysfsFile
+ *
+ * @param  {string} path  : File path
+ * @param  {int}    flags : open(2) flags (O_RDONLY | O_WRONLY | O_RDWR)
+ */
+SysfsFile::SysfsFile(string path, int flags)
+    : path(path), flags(flags | O_CLOEXEC), fd(-1) {}
+
+// Copies share the path, not the descriptor. Each copy opens its own fd.
+SysfsFile::SysfsFile(const SysfsFile &other)
+    : path(other.path), flags(other.flags), fd(-1) {}
+
+SysfsFile::~SysfsFile() { close(); }
+
+SysfsFile &SysfsFile::operator=(const SysfsFile &other) {
+  if (this != &other) {
+    close();
+    path  = other.path;
+    flags = other.flags;
+  }
+  return *this;
+}
+
+string SysfsFile::getPath() const { return path; }
+
+/**
+ * Persistent sysfs file getter. Opens the file if needed.
+ *
+ * @class  utils::SysfsFile
+ * @public SysfsFile::getFd
+ *
+ * @return {int} : File descriptor or -1 if it can't be opened
+ */
+int SysfsFile::getFd() {
+  if (fd < 0) reopen();
+  return fd;
+}
+
+void SysfsFile::setPath(string _path) {
+  close();
+  path = _path;
+}
+
+void SysfsFile::close() {
+  if (fd >= 0) ::close(fd);
+  fd = -1;
+}
+
+/**
+ * Persistent sysfs file function. Closes and opens again the file.
+ *
+ * @class   utils::SysfsFile
+ * @private SysfsFile::reopen
+ *
+ * @return {bool} : True if the file is open
+ */
+bool SysfsFile::reopen() {
+  close();
+  if (path != "") fd = open(path.c_str(), flags);
+  return fd >= 0;
+}
+
+/**
+ * Persistent sysfs file function. Reads the file content from offset 0.
+ *
+ * @class  utils::SysfsFile
+ * @public SysfsFile::read
+ *
+ * @param  {char*}  buf  : Where to store the content
+ * @param  {size_t} size : Buffer size
+ *
+ * @return {ssize_t}     : Bytes readed or -1 on error (errno is set)
+ */
+ssize_t SysfsFile::read(char *buf, size_t size) {
+  ssize_t res = -1;
+
+  if (getFd() >= 0 && (res = pread(fd, buf, size, 0)) < 0 &&
+      (errno == ENODEV || errno == ENOENT) && reopen())
+    res = pread(fd, buf, size, 0);
+
+  return res;
+}
+
+/**
+ * Persistent sysfs file function. Reads an integer value.
+ *
+ * @class  utils::SysfsFile
+ * @public SysfsFile::readInt
+ *
+ * @param  {int&} value : Where to store the value
+ *
+ * @return {bool}       : True if done
+ */
+bool SysfsFile::readInt(int &value) {
+  char buf[32];
+  return parseInt(buf, read(buf, sizeof(buf)), value);
+}
+
+/**
+ * Persistent sysfs file function. Reads an integer value.
+ * Throws a runtime_error if the file can't be readed.
+ *
+ * @class  utils::SysfsFile
+ * @public SysfsFile::readInt
+ *
+ * @return {int} : Value readed
+ */
+int SysfsFile::readInt() {
+  int value;
+
+  if (!readInt(value)) throw runtime_error("Can't read file " + path);
+
+  return value;
+}
+
+/**
+ * Persistent sysfs file function. Writes the content at offset 0.
+ *
+ * @class  utils::SysfsFile
+ * @public SysfsFile::write
+ *
+ * @param  {const char*} buf  : Content to write
+ * @param  {size_t}      size : Content size
+ *
+ * @return {bool}             : True if done
+ */
+bool SysfsFile::write(const char *buf, size_t size) {
+  ssize_t res = -1;
+
+  if (getFd() >= 0 && (res = pwrite(fd, buf, size, 0)) < 0 &&
+      (errno == ENODEV || errno == ENOENT) && reopen())
+    res = pwrite(fd, buf, size, 0);
+
+  return res == (ssize_t)size;
+}
+
+bool SysfsFile::writeInt(int value) {
+  char buf[16];
+  return write(buf, formatInt(buf, value));
+}
+
+/**
+ * Persistent sysfs file static function.
+ * Parses a decimal integer like sysfs files stores it ("-1234\n").
+ *
+ * @class  utils::SysfsFile
+ * @public SysfsFile::parseInt
+ *
+ * @param  {const char*} buf   : Buffer to parse
+ * @param  {ssize_t}     size  : Buffer size (negative is an error)
+ * @param  {int&}        value : Where to store the value
+ *
+ * @return {bool}              : True if a number was found
+ */
+bool SysfsFile::parseInt(const char *buf, ssize_t size, int &value) {
+  ssize_t i      = 0;
+  bool    neg    = false;
+  long    result = 0;
+
+  while (i < size && (buf[i] == ' ' || buf[i] == '\t')) i++;
+  if (i < size && (buf[i] == '-' || buf[i] == '+')) neg = buf[i++] == '-';
+  if (i >= size || buf[i] < '0' || buf[i] > '9') return false;
+
+  while (i < size && buf[i] >= '0' && buf[i] <= '9')
+    result = result * 10 + (buf[i++] - '0');
+
+  value = neg ? -result : result;
+  return true;
+}
+
+/**
+ * Persistent sysfs file static function.
+ * Formats an integer on a buffer with at least 12 chars. No trailing zero.
+ *
+ * @class  utils::SysfsFile
+ * @public SysfsFile::formatInt
+ *
+ * @param  {char*} buf   : Output buffer
+ * @param  {int}   value : Value to format
+ *
+ * @return {int}         : Number of chars written
+ */
+int SysfsFile::formatInt(char *buf, int value) {
+  char         tmp[12];
+  int          len = 0, i = 0;
+  unsigned int uValue = value < 0 ? -(unsigned int)value : value;
+
+  do tmp[len++] = '0' + uValue % 10;
+  while (uValue /= 10);
+
+  if (value < 0) buf[i++] = '-';
+  while (len > 0) buf[i++] = tmp[--len];
+
+  return i;
+}
+
 /**
  * Returs true if give an integer from cin
  * and stores the value in var
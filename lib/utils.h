@@ -14,7 +14,9 @@
 #ifndef UTILS_
 #define UTILS_
 
+#include <fcntl.h>
 #include <iostream>
+#include <sys/types.h>
 #include <vector>
 
 using namespace std;
@@ -24,27 +26,46 @@ namespace utils {
 
 string checkDir(string &);
 string readFile(string, bool = false);
+string readFileAt(int, string, bool = false);
 bool   writeFile(string, string);
 bool   appendFile(string, string);
+bool   writeAll(int, const char *, size_t);
+bool   replaceFile(string, const string &, mode_t = 0644);
+bool   isTrusted(string);
+int    openTrusted(string, string);
+
+vector<string> listDir(string, string = "", string = "");
+vector<string> listDirAt(int, string = "", string = "");
 
 void closeSTDdescriptors();
 
 /**
  * System shell command class.
  * Can exec a system command and stores the result in a Container<string>.
+ * Commands are spawned directly when they don't need a shell, and through
+ * /bin/sh otherwise. Every command has a deadline, after it is killed.
  *
  * @class utils::ShellCommand
  */
 class ShellCommand {
 private:
-  string         command; // command executed
-  string         error;   // getLine() error
-  vector<string> lines;   // data command result
-  int            pos;     // position line
-  unsigned int   size;    // number of lines on dataBuffer
+  string         command;   // command executed
+  string         error;     // exec() error
+  string         errOutput; // command stderr output
+  vector<string> lines;     // data command result
+  vector<char>   buffer;    // pipes read buffer, reused between execs
+  int            pos;       // position line
+  unsigned int   size;      // number of lines on dataBuffer
+  int            timeout;   // command deadline in milliseconds
+  int            status;    // command exit status, -1 if it didn't exit
+
+  bool run(const vector<string> &);
 
 public:
-  ShellCommand(string = "");
+  static const int DEFAULT_TIMEOUT = 5000; // Default deadline milliseconds
+
+  ShellCommand(string = "", int = DEFAULT_TIMEOUT);
+  ShellCommand(const vector<string> &, int = DEFAULT_TIMEOUT);
   ~ShellCommand();
 
   bool   getLine(string &);
@@ -53,8 +74,103 @@ public:
   string lastLine() const;
   int    currLine() const;
   int    getSize() const;
+  string getError() const;
+  string getStderr() const;
+  int    getStatus() const;
+  int    getTimeout() const;
+
+  void setTimeout(int);
 
   bool exec(string = "");
+  bool exec(const vector<string> &);
+
+  static bool           needsShell(const string &);
+  static vector<string> splitArgs(const string &);
+};
+
+/**
+ * Long lived child process class.
+ * Spawns a program once and talks to it through its stdin/stdout, a unix
+ * socket pair so a dead child never raises SIGPIPE. Every read has a
+ * deadline, on timeouts or EOF the child is killed and the next exchange
+ * starts it again, at most once per RESTART_DELAY.
+ *
+ * @class utils::CoProcess
+ */
+class CoProcess {
+private:
+  vector<string> argv;    // program and arguments
+  int            execFd;  // program descriptor run instead of argv[0], or -1
+  pid_t          pid;     // child pid, -1 while stopped
+  int            fd;      // child stdin/stdout socket, -1 while stopped
+  string         buffer;  // data readed and not consumed yet
+  string         error;   // last error
+  int            timeout; // read deadline in milliseconds
+  long long      started; // last start time, steady clock milliseconds
+
+public:
+  static const int DEFAULT_TIMEOUT = 2000; // Default deadline milliseconds
+  static const int RESTART_DELAY   = 5000; // Milliseconds between restarts
+  static const int EXEC_FD         = 3;    // Program descriptor on the child
+
+  CoProcess(const vector<string> & = vector<string>(), int = DEFAULT_TIMEOUT);
+  ~CoProcess();
+
+  vector<string> getArgv() const;
+  string         getError() const;
+  int            getTimeout() const;
+  pid_t          getPid() const;
+
+  void setArgv(const vector<string> &);
+  void setExecFd(int);
+  void setTimeout(int);
+
+  bool isRunning();
+  bool start();
+  void stop();
+
+  bool write(const string &);
+  bool readUntil(const string &, string &);
+  bool readLine(string &);
+};
+
+/**
+ * Persistent sysfs attribute file.
+ * Opens the file once and keeps the descriptor open, reads and writes are
+ * done with pread/pwrite at offset 0. If the device goes away (ENODEV/ENOENT)
+ * the file is reopened and the operation retried once.
+ *
+ * @class utils::SysfsFile
+ */
+class SysfsFile {
+private:
+  string path;  // file path
+  int    flags; // open(2) flags
+  int    fd;    // file descriptor, -1 while closed
+
+  bool reopen();
+
+public:
+  SysfsFile(string = "", int = O_RDONLY);
+  SysfsFile(const SysfsFile &);
+  ~SysfsFile();
+
+  SysfsFile &operator=(const SysfsFile &);
+
+  string getPath() const;
+  int    getFd();
+
+  void setPath(string);
+  void close();
+
+  ssize_t read(char *, size_t);
+  bool    readInt(int &);
+  int     readInt();
+  bool    write(const char *, size_t);
+  bool    writeInt(int);
+
+  static bool parseInt(const char *, ssize_t, int &);
+  static int  formatInt(char *, int);
 };
 
 bool cinToInt(int &);
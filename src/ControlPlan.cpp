@@ -0,0 +1,312 @@
+/*
+ *  Control plan class declarations.
+ *
+ *  File: ControlPlan.cpp
+ *  Author: b4fThrive
+ *  Copyright (c) 2020 b4f.thrive@gmail.com
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "ControlPlan.h"
+#include "Sensors.h"
+#include "utils.h"
+
+using namespace std;
+using namespace utils;
+
+const char ControlPlan::MAGIC[8] = {'F', 'C', 'P', 'L', 'A', 'N', '\n', '\0'};
+
+/******************************************************************************
+ * Payload encoding
+ ******************************************************************************/
+
+static void putU32(string &buf, uint32_t value) {
+  buf.append((const char *)&value, sizeof(value));
+}
+
+static void putStr(string &buf, const string &str) {
+  putU32(buf, str.size());
+  buf += str;
+}
+
+static void putSensor(string &buf, const SensorCfg &sensor) {
+  putStr(buf, sensor.type);
+  putStr(buf, sensor.devName);
+  putStr(buf, sensor.path);
+  putStr(buf, sensor.name);
+  putStr(buf, sensor.minT);
+  putStr(buf, sensor.maxT);
+  putStr(buf, sensor.offsetT);
+  putStr(buf, sensor.cLabel);
+}
+
+// Payload reads never go past the end, truncated payloads throw
+static uint32_t getU32(const char *&pos, const char *end) {
+  uint32_t value;
+
+  if (end - pos < (ptrdiff_t)sizeof(value))
+    throw runtime_error("Truncated control plan");
+
+  memcpy(&value, pos, sizeof(value));
+  pos += sizeof(value);
+
+  return value;
+}
+
+static string getStr(const char *&pos, const char *end) {
+  uint32_t size = getU32(pos, end);
+
+  if ((size_t)(end - pos) < size) throw runtime_error("Truncated control plan");
+
+  pos += size;
+
+  return string(pos - size, size);
+}
+
+static SensorCfg getSensor(const char *&pos, const char *end) {
+  SensorCfg sensor;
+
+  sensor.type    = getStr(pos, end);
+  sensor.devName = getStr(pos, end);
+  sensor.path    = getStr(pos, end);
+  sensor.name    = getStr(pos, end);
+  sensor.minT    = getStr(pos, end);
+  sensor.maxT    = getStr(pos, end);
+  sensor.offsetT = getStr(pos, end);
+  sensor.cLabel  = getStr(pos, end);
+
+  return sensor;
+}
+
+/******************************************************************************
+ * ControlPlan
+ ******************************************************************************/
+
+// FNV-1a hash, used for the fingerprints and the payload checksum
+uint64_t ControlPlan::hash(const void *data, size_t size, uint64_t value) {
+  const unsigned char *bytes = (const unsigned char *)data;
+
+  for (size_t i = 0; i < size; i++) {
+    value ^= bytes[i];
+    value *= 1099511628211ULL;
+  }
+
+  return value;
+}
+
+/**
+ * Control plan class static function. Fingerprints the config file by its
+ * inode, size and modification time, so it isn't readed.
+ *
+ * @class  ControlPlan
+ * @public ControlPlan::configFingerprint
+ *
+ * @param  {string} cfgPath : Config file path
+ *
+ * @return {uint64_t}       : Fingerprint, 0 if the file doesn't exist
+ */
+uint64_t ControlPlan::configFingerprint(string cfgPath) {
+  struct stat st;
+  uint64_t    fields[5];
+
+  if (stat(cfgPath.c_str(), &st) < 0) return 0;
+
+  fields[0] = st.st_dev;
+  fields[1] = st.st_ino;
+  fields[2] = st.st_size;
+  fields[3] = st.st_mtim.tv_sec;
+  fields[4] = st.st_mtim.tv_nsec;
+
+  return hash(fields, sizeof(fields));
+}
+
+/**
+ * Control plan class static function. Fingerprints the hwmon devices by the
+ * hwmonN links targets, a renumbered or replaced device changes it.
+ *
+ * @class  ControlPlan
+ * @public ControlPlan::hwmonFingerprint
+ *
+ * @return {uint64_t} : Fingerprint
+ */
+uint64_t ControlPlan::hwmonFingerprint() {
+  vector<string> hwmonDirs = listDir(HWMON_CLASS_DIR, "hwmon");
+  uint64_t       value     = HASH_SEED;
+  char           target[PATH_MAX];
+
+  for (unsigned int i = 0; i < hwmonDirs.size(); i++) {
+    string  link = HWMON_CLASS_DIR + hwmonDirs[i];
+    ssize_t len  = readlink(link.c_str(), target, sizeof(target));
+
+    value = hash(link.c_str(), link.size() + 1, value);
+    if (len > 0) value = hash(target, len, value);
+  }
+
+  return value;
+}
+
+/**
+ * Control plan class function. Decodes a payload.
+ *
+ * @class   ControlPlan
+ * @private ControlPlan::decode
+ *
+ * @param  {const char*} pos : Payload start
+ * @param  {const char*} end : Payload end
+ */
+void ControlPlan::decode(const char *pos, const char *end) {
+  uint32_t fansSize = getU32(pos, end);
+
+  fans.clear();
+  settings.clear();
+
+  for (uint32_t i = 0; i < fansSize; i++) {
+    FanCfg fan;
+
+    fan.type    = getStr(pos, end);
+    fan.devName = getStr(pos, end);
+    fan.path    = getStr(pos, end);
+    fan.name    = getStr(pos, end);
+    fan.cLabel  = getStr(pos, end);
+
+    uint32_t sensorsSize = getU32(pos, end);
+    for (uint32_t j = 0; j < sensorsSize; j++)
+      fan.sensors.push_back(getSensor(pos, end));
+
+    fans.push_back(fan);
+  }
+
+  ambSensor = getSensor(pos, end);
+
+  uint32_t settingsSize = getU32(pos, end);
+  for (uint32_t i = 0; i < settingsSize; i++) {
+    string key = getStr(pos, end);
+
+    settings[key] = getStr(pos, end);
+  }
+
+  if (pos != end) throw runtime_error("Trailing control plan data");
+}
+
+/**
+ * Control plan class function. Loads a plan file, only if it was saved by
+ * this version, it isn't corrupted and the config file and hwmon devices are
+ * the same ones it was saved with.
+ *
+ * @class  ControlPlan
+ * @public ControlPlan::load
+ *
+ * @param  {string} path    : Plan file path
+ * @param  {string} cfgPath : Config file path
+ *
+ * @return {bool}           : True if the plan was loaded
+ */
+bool ControlPlan::load(string path, string cfgPath) {
+  int         fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  void *      data;
+  bool        loaded = false;
+
+  if (fd < 0) return false;
+
+  if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(Header)) {
+    close(fd);
+    return false;
+  }
+
+  data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (data == MAP_FAILED) return false;
+
+  const Header *header  = (const Header *)data;
+  const char *  payload = (const char *)data + sizeof(Header);
+  uint64_t      config  = configFingerprint(cfgPath);
+
+  if (!memcmp(header->magic, MAGIC, sizeof(MAGIC)) &&
+      header->version == VERSION &&
+      header->size == st.st_size - sizeof(Header) && config != 0 &&
+      header->config == config && header->hwmon == hwmonFingerprint() &&
+      header->checksum == hash(payload, header->size)) {
+    ControlPlan plan;
+
+    try {
+      plan.decode(payload, payload + header->size);
+      *this  = plan;
+      loaded = true;
+    } catch (const exception &e) {
+    }
+  }
+
+  munmap(data, st.st_size);
+
+  return loaded;
+}
+
+/**
+ * Control plan class function. Saves the plan file, it must be called once
+ * the config file is written, its fingerprint is stored. The file is
+ * replaced atomically with utils::replaceFile.
+ *
+ * @class  ControlPlan
+ * @public ControlPlan::save
+ *
+ * @param  {string} path    : Plan file path
+ * @param  {string} cfgPath : Config file path
+ *
+ * @return {bool}           : True if the plan was saved
+ */
+bool ControlPlan::save(string path, string cfgPath) const {
+  string payload;
+  Header header;
+
+  putU32(payload, fans.size());
+  for (unsigned int i = 0; i < fans.size(); i++) {
+    putStr(payload, fans[i].type);
+    putStr(payload, fans[i].devName);
+    putStr(payload, fans[i].path);
+    putStr(payload, fans[i].name);
+    putStr(payload, fans[i].cLabel);
+
+    putU32(payload, fans[i].sensors.size());
+    for (unsigned int j = 0; j < fans[i].sensors.size(); j++)
+      putSensor(payload, fans[i].sensors[j]);
+  }
+
+  putSensor(payload, ambSensor);
+
+  putU32(payload, settings.size());
+  for (map<string, string>::const_iterator it = settings.begin();
+       it != settings.end(); it++) {
+    putStr(payload, it->first);
+    putStr(payload, it->second);
+  }
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version  = VERSION;
+  header.size     = payload.size();
+  header.config   = configFingerprint(cfgPath);
+  header.hwmon    = hwmonFingerprint();
+  header.checksum = hash(payload.data(), payload.size());
+
+  return header.config != 0 &&
+         replaceFile(path,
+                     string((const char *)&header, sizeof(header)) + payload,
+                     0660);
+}
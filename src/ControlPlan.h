@@ -0,0 +1,87 @@
+/*
+ *  Control plan class definition.
+ *
+ *  File: ControlPlan.h
+ *  Author: b4fThrive
+ *  Copyright (c) 2020 b4f.thrive@gmail.com
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#ifndef CONTROL_PLAN_H_
+#define CONTROL_PLAN_H_
+
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Sensor config values, as stored on the config file.
+ *
+ * @struct SensorCfg
+ */
+struct SensorCfg {
+  string type, devName, path, name, minT, maxT, offsetT, cLabel;
+};
+
+/**
+ * Fan config values and its sensors, as stored on the config file.
+ *
+ * @struct FanCfg
+ */
+struct FanCfg {
+  string            type, devName, path, name, cLabel;
+  vector<SensorCfg> sensors;
+};
+
+/**
+ * Control plan class.
+ * The config once parsed and resolved: fans, sensors and the "key=value"
+ * settings with the cached labels and ranges. It is stored next to the
+ * config as a binary file, loaded with mmap on start while the config file
+ * and the hwmon devices are the same ones it was saved with.
+ *
+ * File layout is a Header and the payload: a fans count, each fan fields,
+ * its sensors count and fields, the ambient sensor fields, a settings count
+ * and the keys and values. Counts are uint32_t and strings a uint32_t length
+ * and its bytes, all in host byte order.
+ *
+ * @class ControlPlan
+ */
+class ControlPlan {
+private:
+  struct Header {
+    char     magic[8]; // MAGIC
+    uint32_t version;  // VERSION
+    uint32_t size;     // Payload size
+    uint64_t config;   // Config file fingerprint
+    uint64_t hwmon;    // hwmon devices fingerprint
+    uint64_t checksum; // Payload checksum
+  };
+
+  void decode(const char *, const char *);
+
+  static uint64_t hash(const void *, size_t, uint64_t = HASH_SEED);
+
+public:
+  static const char     MAGIC[8];
+  static const uint32_t VERSION   = 1;
+  static const uint64_t HASH_SEED = 14695981039346656037ULL; // FNV-1a
+
+  vector<FanCfg>      fans;      // Fans and their sensors
+  SensorCfg           ambSensor; // Ambient sensor
+  map<string, string> settings;  // Settings and cached values
+
+  bool load(string, string);
+  bool save(string, string) const;
+
+  static uint64_t configFingerprint(string);
+  static uint64_t hwmonFingerprint();
+};
+
+#endif /* CONTROL_PLAN_H_ */
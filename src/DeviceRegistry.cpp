@@ -0,0 +1,470 @@
+/*
+ *  Hotplug devices registry class declarations.
+ *
+ *  File: DeviceRegistry.cpp
+ *  Author: b4fThrive
+ *  Copyright (c) 2020 b4f.thrive@gmail.com
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <linux/netlink.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#include "DeviceRegistry.h"
+#include "Sensors.h"
+#include "utils.h"
+
+using namespace std;
+using namespace utils;
+
+/**
+ * Hotplug devices registry class constructor. Subscribes to the kernel
+ * uevents, without the socket the devices are just never rebound.
+ *
+ * @class  DeviceRegistry
+ * @public DeviceRegistry::DeviceRegistry
+ */
+DeviceRegistry::DeviceRegistry()
+    : fd(socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK,
+                NETLINK_KOBJECT_UEVENT)) {
+  sockaddr_nl addr;
+  int         bufSize = RCVBUF_SIZE;
+
+  if (fd < 0) return;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.nl_family = AF_NETLINK;
+  addr.nl_groups = 1; // Kernel events, not the udev ones
+
+  // Forced size needs CAP_NET_ADMIN, fanControl usually has it
+  if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &bufSize, sizeof(bufSize)))
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufSize, sizeof(bufSize));
+
+  if (::bind(fd, (sockaddr *)&addr, sizeof(addr)) < 0) {
+    close(fd);
+    fd = -1;
+  }
+}
+
+DeviceRegistry::~DeviceRegistry() {
+  if (fd >= 0) close(fd);
+}
+
+bool DeviceRegistry::isListening() const { return fd >= 0; }
+
+// Real path of a sysfs entry, "" if it doesn't exist
+string DeviceRegistry::realPath(string path) {
+  char real[PATH_MAX];
+  return realpath(path.c_str(), real) ? real : "";
+}
+
+// Removes leading and trailing spaces
+static string trim(string str) {
+  size_t start = str.find_first_not_of(" \t");
+  size_t end   = str.find_last_not_of(" \t");
+  return start == string::npos ? "" : str.substr(start, end - start + 1);
+}
+
+/**
+ * Hotplug devices registry class static function. Gets the parent device of
+ * a hwmonN directory from its class link target, with one readlink and no
+ * reads ("../../devices/platform/nct6775.656/hwmon/hwmon3" is on
+ * "/sys/devices/platform/nct6775.656").
+ *
+ * @class   DeviceRegistry
+ * @private DeviceRegistry::linkParent
+ *
+ * @param  {string} dir : hwmonN directory on the hwmon class
+ *
+ * @return {string}     : Parent device path, "" if it doesn't exist
+ */
+string DeviceRegistry::linkParent(string dir) {
+  char    target[PATH_MAX];
+  string  link = dir.substr(0, dir.find_last_not_of('/') + 1);
+  ssize_t len  = readlink(link.c_str(), target, sizeof(target) - 1);
+
+  if (len <= 0) return "";
+
+  string parent(target, len);
+
+  parent = parent.substr(0, parent.rfind('/'));
+  if (parent.size() > 6 && parent.substr(parent.size() - 6) == "/hwmon")
+    parent = parent.substr(0, parent.size() - 6);
+
+  while (parent.compare(0, 3, "../") == 0)
+    parent = parent.substr(3);
+
+  return "/sys/" + parent;
+}
+
+/**
+ * Hotplug devices registry class static function. Gets the hwmonN
+ * directory of a path on the hwmon class.
+ *
+ * @class  DeviceRegistry
+ * @public DeviceRegistry::hwmonDir
+ *
+ * @param  {string} path : Any path (ex: /sys/class/hwmon/hwmon3/device/)
+ *
+ * @return {string}      : hwmonN directory, "" if it isn't on the class
+ */
+string DeviceRegistry::hwmonDir(string path) {
+  size_t end;
+
+  if (path.compare(0, HWMON_CLASS_DIR.size(), HWMON_CLASS_DIR) != 0 ||
+      (end = path.find('/', HWMON_CLASS_DIR.size())) == string::npos)
+    return "";
+
+  return path.substr(0, end + 1);
+}
+
+/**
+ * Hotplug devices registry class static function. Gets a hwmonN directory
+ * identity, its hwmon name and parent device path.
+ *
+ * @class  DeviceRegistry
+ * @public DeviceRegistry::identity
+ *
+ * @param  {string} dir : hwmonN directory on the hwmon class
+ *
+ * @return {string}     : "<name> <parent>", "" if the device doesn't exist
+ */
+string DeviceRegistry::identity(string dir) {
+  string parent = linkParent(dir);
+  string name   = trim(readFile(checkDir(dir) + "name", true));
+
+  if (name == "") name = trim(readFile(dir + "device/name", true));
+
+  return parent == "" || name == "" ? "" : name + " " + parent;
+}
+
+/**
+ * Hotplug devices registry class static function. Gets the current hwmonN
+ * directory of a device identity. The stored directory is checked first, the
+ * hwmon class links are only listed if it moved. The stored directory is
+ * never a fallback, it could be another chip by now.
+ *
+ * @class  DeviceRegistry
+ * @public DeviceRegistry::resolve
+ *
+ * @param  {string} dir      : Last known hwmonN directory
+ * @param  {string} identity : Device identity
+ *
+ * @return {string}          : hwmonN directory, "" if the device isn't found
+ */
+string DeviceRegistry::resolve(string dir, string identity) {
+  size_t sep    = identity.find(' ');
+  string parent = sep == string::npos ? "" : identity.substr(sep + 1);
+
+  if (parent == "" || DeviceRegistry::identity(dir) == identity) return dir;
+
+  vector<string> hwmonDirs = listDir(HWMON_CLASS_DIR, "hwmon");
+
+  // Parents with more than one hwmon device are told apart by the name
+  for (unsigned int i = 0; i < hwmonDirs.size(); i++) {
+    string candidate = HWMON_CLASS_DIR + hwmonDirs[i] + "/";
+
+    if (linkParent(candidate) == parent &&
+        DeviceRegistry::identity(candidate) == identity)
+      return candidate;
+  }
+
+  return "";
+}
+
+/**
+ * Hotplug devices registry class function. Finds a tracked device, adding
+ * it the first time, with its current identity.
+ *
+ * @class   DeviceRegistry
+ * @private DeviceRegistry::find
+ *
+ * @param  {string} path : hwmon directory
+ * @param  {string} disk : Disk name, "" for hwmon devices
+ *
+ * @return {int}         : Device index
+ */
+int DeviceRegistry::find(string path, string disk) {
+  string real = realPath(path);
+
+  for (unsigned int i = 0; i < devices.size(); i++)
+    if (devices[i].path == checkDir(path) ||
+        (real != "" && devices[i].real == real))
+      return i;
+
+  Device device;
+
+  device.disk    = disk;
+  device.path    = checkDir(path);
+  device.real    = real;
+  device.name    = trim(readFile(device.path + "name", true));
+  device.parent  = realPath(device.path + "device");
+  device.missing = real == "";
+
+  devices.push_back(device);
+
+  return devices.size() - 1;
+}
+
+void DeviceRegistry::track(Sensor *sensor) {
+  if (sensor->type == Sensor::hwmon)
+    devices[find(sensor->getPath(), "")].sensors.push_back(sensor);
+  else if (sensor->type == Sensor::drivetemp)
+    devices[find(sensor->getPath(), sensor->getDevName())].sensors.push_back(
+        sensor);
+}
+
+void DeviceRegistry::track(Fan *fan) {
+  if (fan->type == Fan::hwmon || fan->type == Fan::pwm)
+    devices[find(fan->getPath(), "")].fans.push_back(fan);
+}
+
+/**
+ * Hotplug devices registry class function. Moves a device sensors and fans
+ * to its new hwmon directory.
+ *
+ * @class   DeviceRegistry
+ * @private DeviceRegistry::bind
+ *
+ * @param  {Device&} device : Tracked device
+ * @param  {string}  path   : New hwmon directory
+ */
+void DeviceRegistry::bind(Device &device, string path) {
+  device.path    = checkDir(path);
+  device.real    = realPath(device.path);
+  device.missing = false;
+
+  for (unsigned int i = 0; i < device.sensors.size(); i++)
+    device.sensors[i]->rebind(device.path);
+  for (unsigned int i = 0; i < device.fans.size(); i++)
+    device.fans[i]->rebind(device.path);
+}
+
+/**
+ * Hotplug devices registry class function. Unbinds a removed device, its
+ * sensors are missing until it comes back.
+ *
+ * @class   DeviceRegistry
+ * @private DeviceRegistry::unbind
+ *
+ * @param  {Device&} device : Tracked device
+ */
+void DeviceRegistry::unbind(Device &device) {
+  device.real    = "";
+  device.missing = true;
+
+  for (unsigned int i = 0; i < device.sensors.size(); i++) {
+    device.sensors[i]->rebind("");
+    device.sensors[i]->setMissing(true);
+  }
+  for (unsigned int i = 0; i < device.fans.size(); i++)
+    device.fans[i]->rebind("");
+}
+
+/**
+ * Hotplug devices registry class function. Checks if a hwmon directory is a
+ * missing device. Strict matches need the same parent device, the others
+ * take a device on another parent when the old one is gone too (replugged
+ * on another port).
+ *
+ * @class   DeviceRegistry
+ * @private DeviceRegistry::matches
+ *
+ * @param  {Device&} device : Missing hwmon device
+ * @param  {string}  path   : hwmon directory
+ * @param  {bool}    strict : Same parent device needed
+ *
+ * @return {bool}           : True if it's the same device
+ */
+bool DeviceRegistry::matches(const Device &device, string path,
+                             bool strict) const {
+  if (!device.missing || device.disk != "" || device.name == "" ||
+      trim(readFile(checkDir(path) + "name", true)) != device.name)
+    return false;
+
+  if (realPath(path + "device") == device.parent) return true;
+
+  return !strict && access(device.parent.c_str(), F_OK) < 0;
+}
+
+/**
+ * Hotplug devices registry class function. Binds the missing devices that
+ * are back with an added device.
+ *
+ * @class   DeviceRegistry
+ * @private DeviceRegistry::added
+ *
+ * @param  {string} subsystem : Device subsystem (hwmon or block)
+ * @param  {string} devPath   : Device path under /sys
+ * @param  {string} devName   : Block device name
+ */
+void DeviceRegistry::added(string subsystem, string devPath, string devName) {
+  string path = HWMON_CLASS_DIR + devPath.substr(devPath.rfind('/') + 1) + "/";
+
+  // Disks hwmon devices can show up before or after the disk
+  for (unsigned int i = 0; i < devices.size(); i++) {
+    Device &device = devices[i];
+
+    if (!device.missing || device.disk == "" ||
+        (subsystem == "block" && device.disk != devName))
+      continue;
+
+    try {
+      Disks disk(device.disk);
+      if (disk.hwmon != "") bind(device, disk.hwmon);
+    } catch (const exception &e) {
+    }
+  }
+
+  if (subsystem != "hwmon") return;
+
+  for (int strict = 1; strict >= 0; strict--)
+    for (unsigned int i = 0; i < devices.size(); i++)
+      if (matches(devices[i], path, strict)) {
+        bind(devices[i], path);
+        return;
+      }
+}
+
+/**
+ * Hotplug devices registry class function. Unbinds the removed devices.
+ *
+ * @class   DeviceRegistry
+ * @private DeviceRegistry::removed
+ *
+ * @param  {string} subsystem : Device subsystem (hwmon or block)
+ * @param  {string} devPath   : Device path under /sys
+ * @param  {string} devName   : Block device name
+ */
+void DeviceRegistry::removed(string subsystem, string devPath,
+                             string devName) {
+  for (unsigned int i = 0; i < devices.size(); i++) {
+    Device &device = devices[i];
+
+    if (device.missing) continue;
+
+    if (subsystem == "block" ? device.disk == devName
+                             : device.real == "/sys" + devPath)
+      unbind(device);
+  }
+}
+
+/**
+ * Hotplug devices registry class function. Checks every tracked device after
+ * lost events, the hwmon devices are listed once for the missing ones.
+ *
+ * @class   DeviceRegistry
+ * @private DeviceRegistry::resync
+ */
+void DeviceRegistry::resync() {
+  vector<string> hwmonDirs;
+  bool           missing = false;
+
+  for (unsigned int i = 0; i < devices.size(); i++) {
+    Device &device = devices[i];
+
+    if (!device.missing && realPath(device.path) != device.real)
+      unbind(device);
+    missing = missing || device.missing;
+  }
+
+  if (!missing) return;
+
+  hwmonDirs = listDir(HWMON_CLASS_DIR, "hwmon");
+
+  for (unsigned int i = 0; i < hwmonDirs.size(); i++) {
+    string real = realPath(HWMON_CLASS_DIR + hwmonDirs[i]);
+    bool   used = false;
+
+    // Gone since it was listed, uevents dev paths are relative to /sys
+    if (real.compare(0, 5, "/sys/") != 0) continue;
+
+    for (unsigned int j = 0; j < devices.size() && !used; j++)
+      used = devices[j].real == real;
+
+    if (!used) added("hwmon", real.substr(4), "");
+  }
+}
+
+/**
+ * Hotplug devices registry class function. Applies the queued uevents,
+ * called between the control loop ticks.
+ *
+ * @class  DeviceRegistry
+ * @public DeviceRegistry::poll
+ *
+ * @return {int} : Number of events applied
+ */
+int DeviceRegistry::poll() {
+  char        buf[MSG_SIZE];
+  sockaddr_nl from;
+  iovec       iov;
+  msghdr      msg;
+  int         applied = 0;
+  bool        lost    = false;
+
+  while (fd >= 0) {
+    string action, devPath, subsystem, devType, devName;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base    = buf;
+    iov.iov_len     = sizeof(buf) - 1;
+    msg.msg_name    = &from;
+    msg.msg_namelen = sizeof(from);
+    msg.msg_iov     = &iov;
+    msg.msg_iovlen  = 1;
+
+    ssize_t len = recvmsg(fd, &msg, 0);
+
+    if (len < 0 && errno == ENOBUFS) lost = true;
+    if (len < 0 && (errno == ENOBUFS || errno == EINTR)) continue;
+    if (len < 0) break;
+
+    buf[len] = '\0';
+
+    // Only the kernel ones, "action@devpath" header and KEY=value fields
+    if (from.nl_pid != 0 || (msg.msg_flags & MSG_TRUNC) ||
+        !strchr(buf, '@'))
+      continue;
+
+    for (ssize_t pos = strlen(buf) + 1; pos < len;
+         pos += strlen(buf + pos) + 1) {
+      const char *field = buf + pos;
+
+      if (!strncmp(field, "ACTION=", 7)) action = field + 7;
+      else if (!strncmp(field, "DEVPATH=", 8))
+        devPath = field + 8;
+      else if (!strncmp(field, "SUBSYSTEM=", 10))
+        subsystem = field + 10;
+      else if (!strncmp(field, "DEVTYPE=", 8))
+        devType = field + 8;
+      else if (!strncmp(field, "DEVNAME=", 8))
+        devName = field + 8;
+    }
+
+    if (subsystem != "hwmon" && (subsystem != "block" || devType != "disk"))
+      continue;
+
+    if (action == "add") added(subsystem, devPath, devName);
+    else if (action == "remove")
+      removed(subsystem, devPath, devName);
+    else
+      continue;
+
+    applied++;
+  }
+
+  if (lost) resync();
+
+  return applied;
+}
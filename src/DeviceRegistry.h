@@ -0,0 +1,87 @@
+/*
+ *  Hotplug devices registry class definition.
+ *
+ *  File: DeviceRegistry.h
+ *  Author: b4fThrive
+ *  Copyright (c) 2020 b4f.thrive@gmail.com
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#ifndef DEVICE_REGISTRY_H_
+#define DEVICE_REGISTRY_H_
+
+#include <iostream>
+#include <vector>
+
+#include "Sensors.h"
+
+using namespace std;
+
+/**
+ * Hotplug devices registry class.
+ * Follows the hwmon and disk devices used by the controlled fans through the
+ * kernel uevents netlink socket. A removed device is unbound, so its sensors
+ * fail and their fans go to a safe speed, and it is rebound when a device
+ * with the same identity (hwmon name and parent device, or disk name) comes
+ * back, even on another hwmonN directory.
+ *
+ * The kernel queues the events on the socket, poll() applies them between
+ * the control loop ticks. Devices are never enumerated periodically, only
+ * once if the socket overflows and events were lost.
+ *
+ * The same identity is stored on the config for every hwmonN directory, so
+ * a config still works when the devices are numbered in another order
+ * after a reboot or a kernel update.
+ *
+ * @class DeviceRegistry
+ */
+class DeviceRegistry {
+private:
+  struct Device {
+    string           disk;    // Disk name, "" for hwmon devices
+    string           path;    // hwmon directory used by sensors and fans
+    string           real;    // hwmon directory real path, "" while missing
+    string           name;    // hwmon name
+    string           parent;  // hwmon parent device real path
+    bool             missing; // Removed, its sensors and fans are unbound
+    vector<Sensor *> sensors; // Sensors on the device
+    vector<Fan *>    fans;    // Fans on the device
+  };
+
+  int            fd;      // uevent netlink socket, -1 if not available
+  vector<Device> devices; // Tracked devices
+
+  int  find(string, string);
+  void bind(Device &, string);
+  void unbind(Device &);
+  bool matches(const Device &, string, bool) const;
+  void added(string, string, string);
+  void removed(string, string, string);
+  void resync();
+
+  static string realPath(string);
+  static string linkParent(string);
+
+public:
+  static const int RCVBUF_SIZE = 1 << 20; // Socket buffer, events bursts
+  static const int MSG_SIZE    = 8192;    // Maximum uevent message size
+
+  DeviceRegistry();
+  ~DeviceRegistry();
+
+  bool isListening() const;
+
+  void track(Sensor *);
+  void track(Fan *);
+
+  int poll();
+
+  static string hwmonDir(string);
+  static string identity(string);
+  static string resolve(string, string);
+};
+
+#endif /* DEVICE_REGISTRY_H_ */
@@ -0,0 +1,193 @@
+/*
+ *  External sensors helper class declarations.
+ *
+ *  File: ExecHelper.cpp
+ *  Author: b4fThrive
+ *  Copyright (c) 2020 b4f.thrive@gmail.com
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include "ExecHelper.h"
+#include "fanControlConfig.h"
+#include "utils.h"
+
+using namespace std;
+using namespace utils;
+
+map<string, ExecHelper *> ExecHelper::helpers;
+mutex                     ExecHelper::helpersMtx;
+
+/**
+ * External sensors helper class constructor. Opens and checks the helper
+ * program.
+ *
+ * @class   ExecHelper
+ * @private ExecHelper::ExecHelper
+ *
+ * @param  {string} command : Helper command line
+ */
+ExecHelper::ExecHelper(string command)
+    : command(command), helper(ShellCommand::splitArgs(command), TIMEOUT),
+      fd(-1) {
+  vector<string> argv = helper.getArgv();
+
+  if (argv.empty() || (fd = openTrusted(argv[0], FANCONTROL_HELPER_DIR)) < 0)
+    throw runtime_error("Helper not trusted, it must be on " +
+                        string(FANCONTROL_HELPER_DIR) + ": " + command);
+
+  helper.setExecFd(fd);
+}
+
+/**
+ * External sensors helper class static function.
+ * Gets the helper for a command line, one helper is shared by its sensors.
+ *
+ * @class  ExecHelper
+ * @public ExecHelper::get
+ *
+ * @param  {string} command : Helper command line
+ *
+ * @return {ExecHelper*} : Helper, never deleted
+ *
+ * @throws {runtime_error} : If the helper program is not trusted
+ */
+ExecHelper *ExecHelper::get(string command) {
+  lock_guard<mutex> lock(helpersMtx);
+
+  if (helpers.find(command) == helpers.end()) {
+    ExecHelper *helper = new ExecHelper(command); // Throws if not trusted
+
+    helpers[command] = helper;
+  }
+
+  return helpers[command];
+}
+
+string ExecHelper::getCommand() const { return command; }
+
+/**
+ * External sensors helper class function.
+ * Sends the reads of all the sensors at once and collects the answers until
+ * the helper ends the batch.
+ *
+ * @class   ExecHelper
+ * @private ExecHelper::fetch
+ *
+ * @return {bool} : True if the helper ended the batch
+ */
+bool ExecHelper::fetch() {
+  string requests, answer;
+
+  fetched = chrono::steady_clock::now();
+  readings.clear();
+
+  if (sensors.empty()) return true;
+
+  for (unsigned int i = 0; i < sensors.size(); i++)
+    requests += "read " + sensors[i] + "\n";
+
+  if (!helper.write(requests + "\n")) return false;
+
+  while (helper.readLine(answer)) {
+    int value;
+
+    if (answer == "") return true;
+
+    size_t space = answer.find(' ');
+    string id    = answer.substr(0, space);
+    string temp  = space == string::npos ? "" : answer.substr(space + 1);
+
+    if (find(sensors.begin(), sensors.end(), id) != sensors.end() &&
+        SysfsFile::parseInt(temp.c_str(), temp.size(), value))
+      readings[id] = value;
+  }
+
+  return false;
+}
+
+/**
+ * External sensors helper class function. Adds a sensor to the reads.
+ *
+ * @class  ExecHelper
+ * @public ExecHelper::addSensor
+ *
+ * @param  {string} id : Sensor id on the helper
+ */
+void ExecHelper::addSensor(string id) {
+  lock_guard<mutex> lock(mtx);
+
+  for (unsigned int i = 0; i < sensors.size(); i++)
+    if (sensors[i] == id) return;
+
+  sensors.push_back(id);
+  fetched = time_point();
+}
+
+/**
+ * External sensors helper class function. Gets a sensor reading, all the
+ * sensors are readed again if the last fetch is older than maxAge.
+ *
+ * @class  ExecHelper
+ * @public ExecHelper::getReading
+ *
+ * @param  {string} id     : Sensor id on the helper
+ * @param  {int&}   value  : Where to store the millidegrees
+ * @param  {int}    maxAge : Maximum readings age in milliseconds
+ *
+ * @return {bool}          : True if the sensor has a reading
+ */
+bool ExecHelper::getReading(string id, int &value, int maxAge) {
+  addSensor(id);
+
+  lock_guard<mutex> lock(mtx);
+
+  auto age = chrono::duration_cast<chrono::milliseconds>(
+      chrono::steady_clock::now() - fetched);
+
+  if (fetched.time_since_epoch().count() == 0 || age.count() >= maxAge)
+    fetch();
+
+  map<string, int>::iterator it = readings.find(id);
+
+  if (it == readings.end()) return false;
+
+  value = it->second;
+  return true;
+}
+
+/**
+ * External sensors helper class function. Asks the helper for its sensors.
+ *
+ * @class  ExecHelper
+ * @public ExecHelper::list
+ *
+ * @return {map<string,string>} : Sensors labels by id
+ */
+map<string, string> ExecHelper::list() {
+  lock_guard<mutex>   lock(mtx);
+  map<string, string> ids;
+  string              line;
+
+  if (!helper.write("list\n")) return ids;
+
+  while (helper.readLine(line) && line != "") {
+    size_t space = line.find(' ');
+
+    if (space == string::npos) ids[line] = line;
+    else
+      ids[line.substr(0, space)] = line.substr(space + 1);
+  }
+
+  return ids;
+}
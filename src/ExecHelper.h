@@ -0,0 +1,81 @@
+/*
+ *  External sensors helper class definition.
+ *
+ *  File: ExecHelper.h
+ *  Author: b4fThrive
+ *  Copyright (c) 2020 b4f.thrive@gmail.com
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#ifndef EXEC_HELPER_H_
+#define EXEC_HELPER_H_
+
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "utils.h"
+
+using namespace std;
+using namespace utils;
+
+/**
+ * External sensors helper class.
+ * Keeps a helper program running and talks to it with a line protocol:
+ *
+ *   "list"      -> "<id> <label>" lines, ended by an empty line
+ *   "read <id>" -> "<id> <millidegrees>", "<id> error" if there's no reading
+ *   ""          -> "", once the reads sent before it are answered
+ *
+ * One helper can serve several sensors, the reads of all of them are sent
+ * together ended by an empty line, and the answers are matched by id, in
+ * any order, until the helper echoes the empty line. Reads left without an
+ * answer are sensors without reading, only a helper not ending the batch
+ * runs into the deadline. A helper that times out or exits is started again
+ * on the next exchange.
+ *
+ * fanControl runs as root, so the helper program (the first word of the
+ * command) must be a trusted file directly on the helpers directory. It is
+ * checked once and always run from the same descriptor.
+ *
+ * @class ExecHelper
+ */
+class ExecHelper {
+private:
+  typedef chrono::steady_clock::time_point time_point;
+
+  string           command;  // Helper command line
+  CoProcess        helper;   // Helper process
+  int              fd;       // Helper program, checked on the constructor
+  vector<string>   sensors;  // Sensors ids readed on each fetch
+  map<string, int> readings; // Last readings by sensor id
+  time_point       fetched;  // Last fetch time
+  mutex            mtx;      // Exchange lock, sensors share the helper
+
+  static map<string, ExecHelper *> helpers; // Shared helpers by command
+  static mutex                     helpersMtx;
+
+  ExecHelper(string);
+
+  bool fetch();
+
+public:
+  static const int MAX_AGE = 500;  // Milliseconds a fetch is reused
+  static const int TIMEOUT = 1000; // Answer deadline milliseconds
+
+  static ExecHelper *get(string);
+
+  string getCommand() const;
+
+  void addSensor(string);
+  bool getReading(string, int &, int = MAX_AGE);
+
+  map<string, string> list();
+};
+
+#endif /* EXEC_HELPER_H_ */
@@ -0,0 +1,280 @@
+/*
+ *  hddtemp daemon client class declarations.
+ *
+ *  File: HddTempDaemon.cpp
+ *  Author: b4fThrive
+ *  Copyright (c) 2020 b4f.thrive@gmail.com
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+#include "HddTempDaemon.h"
+#include "utils.h"
+
+using namespace std;
+using namespace utils;
+
+const string HDDTEMPD_ADDR = "127.0.0.1:7634";
+
+map<string, HddTempDaemon *> HddTempDaemon::daemons;
+mutex                        HddTempDaemon::daemonsMtx;
+
+HddTempDaemon::HddTempDaemon(string address)
+    : address(address), online(false) {}
+
+/**
+ * hddtemp daemon client class static function.
+ * Gets the client for an address, one client is shared by all the sensors.
+ *
+ * @class  HddTempDaemon
+ * @public HddTempDaemon::get
+ *
+ * @param  {string} address : Daemon address ("host:port" or socket path)
+ *
+ * @return {HddTempDaemon*} : Daemon client, never deleted
+ */
+HddTempDaemon *HddTempDaemon::get(string address) {
+  lock_guard<mutex> lock(daemonsMtx);
+
+  if (address == "") address = HDDTEMPD_ADDR;
+  if (daemons.find(address) == daemons.end())
+    daemons[address] = new HddTempDaemon(address);
+
+  return daemons[address];
+}
+
+string HddTempDaemon::getAddress() const { return address; }
+
+/**
+ * hddtemp daemon client class function. Opens a connection to the daemon.
+ *
+ * @class   HddTempDaemon
+ * @private HddTempDaemon::connectTo
+ *
+ * @param  {int} timeout : Deadline in milliseconds
+ *
+ * @return {int}         : Connected socket or -1
+ */
+int HddTempDaemon::connectTo(int timeout) const {
+  sockaddr_storage addr;
+  socklen_t        addrLen = 0;
+  int              family;
+
+  memset(&addr, 0, sizeof(addr));
+
+  if (address[0] == '/') {
+    sockaddr_un *un = (sockaddr_un *)&addr;
+
+    if (address.size() >= sizeof(un->sun_path)) return -1;
+
+    family         = AF_UNIX;
+    un->sun_family = AF_UNIX;
+    addrLen        = sizeof(sockaddr_un);
+    strcpy(un->sun_path, address.c_str());
+  } else {
+    size_t   colon = address.find_last_of(':');
+    string   host  = colon == string::npos ? address : address.substr(0, colon);
+    string   port  = colon == string::npos ? "7634" : address.substr(colon + 1);
+    addrinfo hints, *res = nullptr;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0 || !res)
+      return -1;
+
+    family  = res->ai_family;
+    addrLen = res->ai_addrlen;
+    memcpy(&addr, res->ai_addr, res->ai_addrlen);
+    freeaddrinfo(res);
+  }
+
+  int sock = socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+  if (sock < 0) return -1;
+
+  if (connect(sock, (sockaddr *)&addr, addrLen) < 0) {
+    pollfd    pfd    = {sock, POLLOUT, 0};
+    int       err    = 0;
+    socklen_t errLen = sizeof(err);
+
+    if (errno != EINPROGRESS || poll(&pfd, 1, timeout) <= 0 ||
+        getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &errLen) < 0 || err) {
+      close(sock);
+      return -1;
+    }
+  }
+
+  return sock;
+}
+
+/**
+ * hddtemp daemon client class function.
+ * Fetches all the disks records with one connection.
+ *
+ * @class  HddTempDaemon
+ * @public HddTempDaemon::fetch
+ *
+ * @param  {int} timeout : Deadline in milliseconds
+ *
+ * @return {bool}        : True if the daemon answered
+ */
+bool HddTempDaemon::fetch(int timeout) {
+  auto   deadline = chrono::steady_clock::now() + chrono::milliseconds(timeout);
+  int    sock     = connectTo(timeout);
+  string data;
+  char   buf[4096];
+
+  fetched = chrono::steady_clock::now();
+  online  = false;
+
+  if (sock < 0) return false;
+
+  while (true) {
+    auto left = chrono::duration_cast<chrono::milliseconds>(
+        deadline - chrono::steady_clock::now());
+    pollfd pfd = {sock, POLLIN, 0};
+
+    if (left.count() <= 0 || poll(&pfd, 1, left.count()) <= 0) break;
+
+    ssize_t len = read(sock, buf, sizeof(buf));
+
+    if (len < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+    if (len <= 0) {
+      online = true; // daemon closes the connection after the records
+      break;
+    }
+
+    data.append(buf, len);
+  }
+
+  close(sock);
+
+  map<string, Record> parsed;
+  if (online && !(online = parse(data, parsed))) return false;
+
+  if (online) records.swap(parsed);
+  return online;
+}
+
+/**
+ * hddtemp daemon client class function.
+ * Fetches the records if the last fetch is older than maxAge.
+ *
+ * @class   HddTempDaemon
+ * @private HddTempDaemon::refresh
+ *
+ * @param  {int} maxAge : Maximum records age in milliseconds
+ *
+ * @return {bool}       : True if the records are valid
+ */
+bool HddTempDaemon::refresh(int maxAge) {
+  auto age = chrono::duration_cast<chrono::milliseconds>(
+      chrono::steady_clock::now() - fetched);
+
+  if (fetched.time_since_epoch().count() == 0 || age.count() >= maxAge)
+    fetch();
+
+  return online;
+}
+
+/**
+ * hddtemp daemon client class function. Gets a disk record.
+ *
+ * @class  HddTempDaemon
+ * @public HddTempDaemon::getRecord
+ *
+ * @param  {string}  device : Disk device path (ex: /dev/sda)
+ * @param  {Record&} record : Where to store the record
+ * @param  {int}     maxAge : Maximum records age in milliseconds
+ *
+ * @return {bool}           : True if the disk is on the daemon records
+ */
+bool HddTempDaemon::getRecord(string device, Record &record, int maxAge) {
+  lock_guard<mutex> lock(mtx);
+
+  if (!refresh(maxAge)) return false;
+
+  map<string, Record>::iterator it = records.find(device);
+
+  if (it == records.end()) return false;
+
+  record = it->second;
+  return true;
+}
+
+bool HddTempDaemon::isOnline() {
+  lock_guard<mutex> lock(mtx);
+  return refresh(MAX_AGE);
+}
+
+map<string, HddTempDaemon::Record> HddTempDaemon::getRecords(int maxAge) {
+  lock_guard<mutex> lock(mtx);
+
+  refresh(maxAge);
+  return records;
+}
+
+/**
+ * hddtemp daemon client class static function.
+ * Parses the daemon answer: "|/dev/sda|model|35|C||/dev/sdb|model|SLP|*|".
+ * Fahrenheit temperatures are converted to Celsius.
+ *
+ * @class  HddTempDaemon
+ * @public HddTempDaemon::parse
+ *
+ * @param  {string}              data    : Daemon answer
+ * @param  {map<string,Record>&} records : Where to store the records
+ *
+ * @return {bool}                        : True if the answer is well formed
+ */
+bool HddTempDaemon::parse(const string &data, map<string, Record> &records) {
+  vector<string> fields;
+  size_t         from = 0, to;
+
+  if (data.empty() || data[0] != '|') return false;
+
+  while ((to = data.find('|', from)) != string::npos) {
+    fields.push_back(data.substr(from, to - from));
+    from = to + 1;
+  }
+
+  // fields: "", dev, model, temp, unit, "", dev, model, temp, unit, ""...
+  for (unsigned int i = 1; i + 3 < fields.size(); i += 5) {
+    Record record;
+    int    value;
+    string temp = fields[i + 2];
+
+    record.model    = fields[i + 1];
+    record.sleeping = temp == "SLP";
+    record.valid    = SysfsFile::parseInt(temp.c_str(), temp.size(), value);
+
+    // Millidegrees Celsius, straight from Fahrenheit to keep the fraction
+    if (!record.valid) record.temp = 0;
+    else if (fields[i + 3] == "F")
+      record.temp = (value - 32) * 5000 / 9;
+    else
+      record.temp = value * 1000;
+
+    records[fields[i]] = record;
+  }
+
+  return true;
+}
@@ -0,0 +1,83 @@
+/*
+ *  hddtemp daemon client class definition.
+ *
+ *  File: HddTempDaemon.h
+ *  Author: b4fThrive
+ *  Copyright (c) 2020 b4f.thrive@gmail.com
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#ifndef HDDTEMP_DAEMON_H_
+#define HDDTEMP_DAEMON_H_
+
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <mutex>
+
+using namespace std;
+
+extern const string HDDTEMPD_ADDR; // Default hddtemp daemon address
+
+/**
+ * hddtemp daemon client class.
+ * Talks to a running `hddtemp -d`, which answers every connection with all
+ * the disks records "|/dev/sda|model|35|C|". One fetch is shared by all the
+ * disks sensors of a tick.
+ *
+ * Address is "host:port" for TCP or a path for a unix socket.
+ *
+ * @class HddTempDaemon
+ */
+class HddTempDaemon {
+public:
+  /**
+   * hddtemp daemon disk record.
+   *
+   * @struct HddTempDaemon::Record
+   */
+  struct Record {
+    string model;    // Disk model
+    int    temp;     // Temperature in millidegrees Celsius
+    bool   valid;    // Temperature readed
+    bool   sleeping; // Disk in standby, no temperature
+  };
+
+private:
+  typedef chrono::steady_clock::time_point time_point;
+
+  string              address; // Daemon address
+  map<string, Record> records; // Last records by device path
+  time_point          fetched; // Last fetch time
+  bool                online;  // Last fetch succeeded
+  mutex               mtx;     // Fetch lock, sensors can share a daemon
+
+  static map<string, HddTempDaemon *> daemons; // Shared clients by address
+  static mutex                        daemonsMtx;
+
+  HddTempDaemon(string);
+
+  int  connectTo(int) const;
+  bool refresh(int);
+
+public:
+  static const int MAX_AGE = 500;  // Milliseconds a fetch is reused
+  static const int TIMEOUT = 1000; // Connection deadline milliseconds
+
+  static HddTempDaemon *get(string = HDDTEMPD_ADDR);
+
+  string getAddress() const;
+
+  bool fetch(int = TIMEOUT);
+  bool getRecord(string, Record &, int = MAX_AGE);
+  bool isOnline();
+
+  map<string, Record> getRecords(int = MAX_AGE);
+
+  static bool parse(const string &, map<string, Record> &);
+};
+
+#endif /* HDDTEMP_DAEMON_H_ */
@@ -0,0 +1,319 @@
+/*
+ *  IPMI session class declarations.
+ *
+ *  File: IpmiSession.cpp
+ *  Author: b4fThrive
+ *  Copyright (c) 2020 b4f.thrive@gmail.com
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <unistd.h>
+#include <vector>
+
+#include "IpmiSession.h"
+#include "utils.h"
+
+using namespace std;
+using namespace utils;
+
+const string IPMITOOL_BIN        = "ipmitool";
+const string IpmiSession::PROMPT = "ipmitool> ";
+
+map<string, IpmiSession *> IpmiSession::sessions;
+mutex                      IpmiSession::sessionsMtx;
+
+/**
+ * Trims spaces on both sides
+ *
+ * @param  {string} str : String to trim
+ *
+ * @return {string}     : Trimmed string
+ */
+static string trim(const string &str) {
+  size_t from = str.find_first_not_of(" \t\r\n");
+  size_t to   = str.find_last_not_of(" \t\r\n");
+
+  return from == string::npos ? "" : str.substr(from, to - from + 1);
+}
+
+IpmiSession::IpmiSession(string args) : args(args) {
+  vector<string> argv = ShellCommand::splitArgs(args);
+
+  argv.insert(argv.begin(), IPMITOOL_BIN);
+  argv.push_back("shell");
+  shell.setArgv(argv);
+}
+
+/**
+ * IPMI session class static function.
+ * Gets the session for some ipmitool options, one session is shared by all
+ * the devices of a BMC.
+ *
+ * @class  IpmiSession
+ * @public IpmiSession::get
+ *
+ * @param  {string} args : ipmitool interface options
+ *
+ * @return {IpmiSession*} : Session, never deleted
+ */
+IpmiSession *IpmiSession::get(string args) {
+  lock_guard<mutex> lock(sessionsMtx);
+
+  if (sessions.find(args) == sessions.end())
+    sessions[args] = new IpmiSession(args);
+
+  return sessions[args];
+}
+
+/**
+ * IPMI session class static function.
+ *
+ * @class  IpmiSession
+ * @public IpmiSession::available
+ *
+ * @return {bool} : True if there is a local BMC device
+ */
+bool IpmiSession::available() {
+  return access("/dev/ipmi0", F_OK) == 0 || access("/dev/ipmi/0", F_OK) == 0 ||
+         access("/dev/ipmidev/0", F_OK) == 0;
+}
+
+string IpmiSession::getArgs() const { return args; }
+
+/**
+ * IPMI session class function.
+ * Sends a command to the shell and reads the answer until the next prompt.
+ * The shell is started, and its first prompt consumed, if it isn't running.
+ *
+ * @class   IpmiSession
+ * @private IpmiSession::exchange
+ *
+ * @param  {string}  cmd    : Command
+ * @param  {string&} answer : Where to store the answer
+ *
+ * @return {bool}           : True if the shell answered
+ */
+bool IpmiSession::exchange(const string &cmd, string &answer) {
+  if (!shell.isRunning() &&
+      (!shell.start() || !shell.readUntil(PROMPT, answer)))
+    return false;
+
+  return shell.write(cmd + "\n") && shell.readUntil(PROMPT, answer);
+}
+
+/**
+ * IPMI session class function. Reads all the registered sensors at once.
+ *
+ * @class   IpmiSession
+ * @private IpmiSession::fetch
+ *
+ * @return {bool} : True if the shell answered
+ */
+bool IpmiSession::fetch() {
+  string cmd = "sensor reading", answer;
+
+  fetched = chrono::steady_clock::now();
+
+  if (sensors.empty()) return true;
+
+  for (unsigned int i = 0; i < sensors.size(); i++)
+    cmd += " \"" + sensors[i] + "\"";
+
+  map<string, double> parsed;
+  if (!exchange(cmd, answer) || !parseReadings(answer, parsed)) {
+    readings.clear(); // Old readings would hide the failure
+    return false;
+  }
+
+  readings.swap(parsed);
+  return true;
+}
+
+/**
+ * IPMI session class function. Adds a sensor to the batched readings.
+ *
+ * @class  IpmiSession
+ * @public IpmiSession::addSensor
+ *
+ * @param  {string} name : SDR sensor name
+ */
+void IpmiSession::addSensor(string name) {
+  lock_guard<mutex> lock(mtx);
+
+  for (unsigned int i = 0; i < sensors.size(); i++)
+    if (sensors[i] == name) return;
+
+  sensors.push_back(name);
+  fetched = time_point();
+}
+
+/**
+ * IPMI session class function. Gets a sensor reading, all the sensors are
+ * fetched again if the last fetch is older than maxAge.
+ *
+ * @class  IpmiSession
+ * @public IpmiSession::getReading
+ *
+ * @param  {string}  name   : SDR sensor name
+ * @param  {double&} value  : Where to store the reading
+ * @param  {int}     maxAge : Maximum readings age in milliseconds
+ *
+ * @return {bool}           : True if the sensor has a reading
+ */
+bool IpmiSession::getReading(string name, double &value, int maxAge) {
+  addSensor(name);
+
+  lock_guard<mutex> lock(mtx);
+
+  auto age = chrono::duration_cast<chrono::milliseconds>(
+      chrono::steady_clock::now() - fetched);
+
+  if (fetched.time_since_epoch().count() == 0 || age.count() >= maxAge)
+    fetch();
+
+  map<string, double>::iterator it = readings.find(name);
+
+  if (it == readings.end()) return false;
+
+  value = it->second;
+  return true;
+}
+
+/**
+ * IPMI session class function. Runs a command, like the raw fan ones.
+ *
+ * @class  IpmiSession
+ * @public IpmiSession::command
+ *
+ * @param  {string} cmd : ipmitool shell command
+ *
+ * @return {bool}       : True if the shell answered
+ */
+bool IpmiSession::command(string cmd) {
+  lock_guard<mutex> lock(mtx);
+  string            answer;
+
+  return exchange(cmd, answer);
+}
+
+/**
+ * IPMI session class function.
+ * Runs a BMC wide mode command, like the manual fans one, only for the first
+ * device asking for it. Later devices are just counted as holders.
+ *
+ * @class  IpmiSession
+ * @public IpmiSession::acquire
+ *
+ * @param  {string} cmd : ipmitool shell command
+ *
+ * @return {bool}       : True if the mode is held
+ */
+bool IpmiSession::acquire(string cmd) {
+  lock_guard<mutex> lock(mtx);
+  string            answer;
+
+  if (holders[cmd] == 0 && !exchange(cmd, answer)) return false;
+
+  holders[cmd]++;
+  return true;
+}
+
+/**
+ * IPMI session class function.
+ * Releases a mode taken with acquire(), the command leaving it is only run
+ * when the last holder releases it.
+ *
+ * @class  IpmiSession
+ * @public IpmiSession::release
+ *
+ * @param  {string} acquired : Command the mode was acquired with
+ * @param  {string} cmd      : ipmitool shell command leaving the mode
+ *
+ * @return {bool}            : True if the mode isn't held any more
+ */
+bool IpmiSession::release(string acquired, string cmd) {
+  lock_guard<mutex> lock(mtx);
+  string            answer;
+
+  if (holders[acquired] <= 0) return true;
+  if (holders[acquired] == 1 && !exchange(cmd, answer)) return false;
+
+  holders[acquired]--;
+  return true;
+}
+
+/**
+ * IPMI session class function. Lists the SDR sensors of a type with readings.
+ *
+ * @class  IpmiSession
+ * @public IpmiSession::listSdr
+ *
+ * @param  {string} type : SDR type (ex: Temperature, Fan)
+ *
+ * @return {vector<string>} : Sensors names
+ */
+vector<string> IpmiSession::listSdr(string type) {
+  lock_guard<mutex> lock(mtx);
+  vector<string>    names;
+  string            answer, line;
+
+  if (!exchange("sdr type " + type, answer)) return names;
+
+  // "CPU Temp | 01h | ok | 3.1 | 45 degrees C"
+  istringstream lines(answer);
+  while (getline(lines, line)) {
+    vector<string> fields;
+    string         field;
+    istringstream  columns(line);
+
+    while (getline(columns, field, '|')) fields.push_back(trim(field));
+
+    if (fields.size() >= 5 && fields[0] != "" && fields[2] != "ns")
+      names.push_back(fields[0]);
+  }
+
+  return names;
+}
+
+/**
+ * IPMI session class static function.
+ * Parses "sensor reading" answers, one "name | value" line per sensor.
+ * Sensors without a reading ("na") are left out.
+ *
+ * @class  IpmiSession
+ * @public IpmiSession::parseReadings
+ *
+ * @param  {string}              answer   : Shell answer
+ * @param  {map<string,double>&} readings : Where to store the readings
+ *
+ * @return {bool}                         : True if any sensor was readed
+ */
+bool IpmiSession::parseReadings(const string &answer,
+                                map<string, double> &readings) {
+  istringstream lines(answer);
+  string        line;
+
+  while (getline(lines, line)) {
+    size_t sep = line.find_last_of('|');
+
+    if (sep == string::npos) continue;
+
+    string name  = trim(line.substr(0, sep));
+    string value = trim(line.substr(sep + 1));
+    char * end;
+    double number = strtod(value.c_str(), &end);
+
+    if (name != "" && value != "" && *end == '\0') readings[name] = number;
+  }
+
+  return !readings.empty();
+}
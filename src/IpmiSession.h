@@ -0,0 +1,81 @@
+/*
+ *  IPMI session class definition.
+ *
+ *  File: IpmiSession.h
+ *  Author: b4fThrive
+ *  Copyright (c) 2020 b4f.thrive@gmail.com
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#ifndef IPMI_SESSION_H_
+#define IPMI_SESSION_H_
+
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "utils.h"
+
+using namespace std;
+using namespace utils;
+
+extern const string IPMITOOL_BIN; // ipmitool program
+
+/**
+ * IPMI session class.
+ * Keeps one `ipmitool [args] shell` running and exchanges commands with it,
+ * the answers are delimited by the shell prompt. All the registered sensors
+ * are readed with one "sensor reading" command, later readings on the same
+ * tick reuse it.
+ *
+ * Args are the ipmitool interface options ("" for the local BMC, or like
+ * "-I lanplus -H host -U user -P pass").
+ *
+ * @class IpmiSession
+ */
+class IpmiSession {
+private:
+  typedef chrono::steady_clock::time_point time_point;
+
+  string              args;     // ipmitool interface options
+  CoProcess           shell;    // ipmitool shell
+  vector<string>      sensors;  // Sensors readed on each fetch
+  map<string, double> readings; // Last readings by sensor name
+  map<string, int>    holders;  // Devices holding each BMC mode command
+  time_point          fetched;  // Last fetch time
+  mutex               mtx;      // Exchange lock, devices share the session
+
+  static map<string, IpmiSession *> sessions; // Shared sessions by args
+  static mutex                      sessionsMtx;
+
+  IpmiSession(string);
+
+  bool exchange(const string &, string &);
+  bool fetch();
+
+public:
+  static const string PROMPT;        // ipmitool shell prompt
+  static const int    MAX_AGE = 500; // Milliseconds a fetch is reused
+
+  static IpmiSession *get(string = "");
+  static bool         available();
+
+  string getArgs() const;
+
+  void addSensor(string);
+  bool getReading(string, double &, int = MAX_AGE);
+  bool command(string);
+  bool acquire(string);
+  bool release(string, string);
+
+  vector<string> listSdr(string);
+
+  static bool parseReadings(const string &, map<string, double> &);
+};
+
+#endif /* IPMI_SESSION_H_ */
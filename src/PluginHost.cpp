@@ -0,0 +1,223 @@
+/*
+ *  Backend plugins host class declarations.
+ *
+ *  File: PluginHost.cpp
+ *  Author: b4fThrive
+ *  Copyright (c) 2020 b4f.thrive@gmail.com
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <chrono>
+#include <cstring>
+#include <dlfcn.h>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <unistd.h>
+#include <vector>
+
+#include "PluginHost.h"
+#include "fanControlConfig.h"
+#include "utils.h"
+
+using namespace std;
+using namespace utils;
+
+map<string, PluginHost *> PluginHost::hosts;
+mutex                     PluginHost::hostsMtx;
+
+/**
+ * Backend plugins host class constructor. Opens the plugin and discovers its
+ * devices.
+ *
+ * @class   PluginHost
+ * @private PluginHost::PluginHost
+ *
+ * @param  {string}     path    : Plugin file path
+ * @param  {void*}      library : dlopen handle
+ * @param  {fc_plugin*} plugin  : Plugin functions table
+ */
+PluginHost::PluginHost(string path, void *library, const fc_plugin *plugin)
+    : path(path), library(library), plugin(plugin),
+      ctx(plugin->open ? plugin->open() : nullptr) {
+  int found = 0;
+
+  devices.resize(64);
+
+  while (plugin->discover &&
+         (found = plugin->discover(ctx, &devices[0], devices.size())) >=
+             (int)devices.size() &&
+         devices.size() < 4096)
+    devices.resize(devices.size() * 2);
+
+  devices.resize(found > 0 ? min(found, (int)devices.size()) : 0);
+
+  for (unsigned int i = 0; i < devices.size(); i++) {
+    devices[i].id[FC_ID_SIZE - 1]    = '\0';
+    devices[i].label[FC_ID_SIZE - 1] = '\0';
+  }
+}
+
+/**
+ * Backend plugins host class static function. Gets a loaded plugin, loading
+ * it the first time. Plugins are never unloaded. Plugins out of the plugins
+ * directory, like ones on a user edited config, are not loaded.
+ *
+ * @class  PluginHost
+ * @public PluginHost::get
+ *
+ * @param  {string} path : Plugin file path
+ *
+ * @return {PluginHost*} : Plugin or nullptr if it can't be loaded
+ */
+PluginHost *PluginHost::get(string path) {
+  lock_guard<mutex> lock(hostsMtx);
+
+  if (hosts.find(path) != hosts.end()) return hosts[path];
+
+  int fd = openTrusted(path, FANCONTROL_PLUGIN_DIR);
+  if (fd < 0) return nullptr;
+
+  // The checked file, the path could point to another one by now
+  string fdPath  = "/proc/self/fd/" + to_string(fd);
+  void * library = dlopen(fdPath.c_str(), RTLD_NOW | RTLD_LOCAL);
+
+  close(fd);
+  if (!library) return nullptr;
+
+  fc_plugin_entry  entry  = (fc_plugin_entry)dlsym(library, FC_PLUGIN_ENTRY);
+  const fc_plugin *plugin = entry ? entry() : nullptr;
+
+  if (!plugin || plugin->abi != FC_PLUGIN_ABI || !plugin->name ||
+      !plugin->open_device || !plugin->read) {
+    dlclose(library);
+    return nullptr;
+  }
+
+  return hosts[path] = new PluginHost(path, library, plugin);
+}
+
+string            PluginHost::getPath() const { return path; }
+string            PluginHost::getName() const { return plugin->name; }
+vector<fc_device> PluginHost::getDevices() const { return devices; }
+
+/**
+ * Backend plugins host class function. Finds a discovered device.
+ *
+ * @class  PluginHost
+ * @public PluginHost::findDevice
+ *
+ * @param  {string}     id     : Device id
+ * @param  {fc_device&} device : Where to store the device
+ *
+ * @return {bool}              : True if the plugin has the device
+ */
+bool PluginHost::findDevice(string id, fc_device &device) const {
+  for (unsigned int i = 0; i < devices.size(); i++)
+    if (id == devices[i].id) {
+      device = devices[i];
+      return true;
+    }
+
+  return false;
+}
+
+int PluginHost::openDevice(string id) {
+  lock_guard<mutex> lock(mtx);
+  return plugin->open_device(ctx, id.c_str());
+}
+
+/**
+ * Backend plugins host class function. Reads all the registered sensors.
+ *
+ * @class   PluginHost
+ * @private PluginHost::fetch
+ */
+void PluginHost::fetch() {
+  int count = sensors.size();
+
+  fetched = chrono::steady_clock::now();
+  readings.clear();
+
+  if (count == 0) return;
+
+  values.assign(count, 0);
+  status.assign(count, -1);
+
+  if (plugin->read(ctx, &sensors[0], count, &values[0], &status[0]) < 0)
+    return;
+
+  for (int i = 0; i < count; i++)
+    if (status[i] == 0) readings[sensors[i]] = values[i];
+}
+
+/**
+ * Backend plugins host class function. Adds a sensor to the batched reads.
+ *
+ * @class  PluginHost
+ * @public PluginHost::addSensor
+ *
+ * @param  {int} handle : Device handle
+ */
+void PluginHost::addSensor(int handle) {
+  lock_guard<mutex> lock(mtx);
+
+  for (unsigned int i = 0; i < sensors.size(); i++)
+    if (sensors[i] == handle) return;
+
+  sensors.push_back(handle);
+  fetched = time_point();
+}
+
+/**
+ * Backend plugins host class function. Gets a sensor reading, all the
+ * sensors are readed again if the last fetch is older than maxAge.
+ *
+ * @class  PluginHost
+ * @public PluginHost::getReading
+ *
+ * @param  {int}  handle : Device handle
+ * @param  {int&} value  : Where to store the reading
+ * @param  {int}  maxAge : Maximum readings age in milliseconds
+ *
+ * @return {bool}        : True if the sensor has a reading
+ */
+bool PluginHost::getReading(int handle, int &value, int maxAge) {
+  lock_guard<mutex> lock(mtx);
+
+  auto age = chrono::duration_cast<chrono::milliseconds>(
+      chrono::steady_clock::now() - fetched);
+
+  if (fetched.time_since_epoch().count() == 0 || age.count() >= maxAge)
+    fetch();
+
+  map<int, int>::iterator it = readings.find(handle);
+
+  if (it == readings.end()) return false;
+
+  value = it->second;
+  return true;
+}
+
+bool PluginHost::read(int handle, int &value) {
+  lock_guard<mutex> lock(mtx);
+  int               res = -1;
+
+  return plugin->read(ctx, &handle, 1, &value, &res) >= 0 && res == 0;
+}
+
+bool PluginHost::write(int handle, int value) {
+  lock_guard<mutex> lock(mtx);
+  int               res = -1;
+
+  return plugin->write &&
+         plugin->write(ctx, &handle, 1, &value, &res) >= 0 && res == 0;
+}
+
+bool PluginHost::manual(int handle, bool on) {
+  lock_guard<mutex> lock(mtx);
+  return plugin->manual && plugin->manual(ctx, handle, on ? 1 : 0) >= 0;
+}
@@ -0,0 +1,80 @@
+/*
+ *  Backend plugins host class definition.
+ *
+ *  File: PluginHost.h
+ *  Author: b4fThrive
+ *  Copyright (c) 2020 b4f.thrive@gmail.com
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#ifndef PLUGIN_HOST_H_
+#define PLUGIN_HOST_H_
+
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "fan_plugin.h"
+
+using namespace std;
+
+/**
+ * Backend plugins host class.
+ * Loads a plugin shared object with dlopen and calls its fc_plugin table.
+ * All the registered sensors of a plugin are readed with one read() call,
+ * later readings on the same tick reuse it.
+ *
+ * Plugins run inside fanControl, so only trusted files directly on the
+ * plugins directory are loaded (see utils::openTrusted). The checked file is
+ * loaded from its descriptor, never from the path again.
+ *
+ * @class PluginHost
+ */
+class PluginHost {
+private:
+  typedef chrono::steady_clock::time_point time_point;
+
+  string            path;     // Plugin file path
+  void *            library;  // dlopen handle
+  const fc_plugin * plugin;   // Plugin functions table
+  void *            ctx;      // Plugin context
+  vector<fc_device> devices;  // Discovered devices
+  vector<int>       sensors;  // Sensors handles readed on each fetch
+  vector<int>       values;   // Batched reads values
+  vector<int>       status;   // Batched reads status
+  map<int, int>     readings; // Last readings by handle
+  time_point        fetched;  // Last fetch time
+  mutex             mtx;      // Calls lock
+
+  static map<string, PluginHost *> hosts; // Loaded plugins by path
+  static mutex                     hostsMtx;
+
+  PluginHost(string, void *, const fc_plugin *);
+
+  void fetch();
+
+public:
+  static const int MAX_AGE = 500; // Milliseconds a fetch is reused
+
+  static PluginHost *get(string);
+
+  string            getPath() const;
+  string            getName() const;
+  vector<fc_device> getDevices() const;
+
+  bool findDevice(string, fc_device &) const;
+  int  openDevice(string);
+
+  void addSensor(int);
+  bool getReading(int, int &, int = MAX_AGE);
+  bool read(int, int &);
+  bool write(int, int);
+  bool manual(int, bool);
+};
+
+#endif /* PLUGIN_HOST_H_ */
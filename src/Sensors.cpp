@@ -10,14 +10,25 @@
  *
  */
 
+#include <algorithm>
+#include <cerrno>
 #include <chrono>
+#include <climits>
+#include <cstring>
 #include <ctime>
+#include <exception>
+#include <fcntl.h>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <sstream>
 #include <sys/stat.h>
 #include <thread>
+#include <unistd.h>
 #include <vector>
 
+#include "DeviceRegistry.h"
 #include "Sensors.h"
 #include "shell_commands.h"
 #include "utils.h"
@@ -26,7 +37,52 @@ using namespace std;
 using namespace utils;
 using namespace utils;
 
-const string HDDTEMP_BIN = utils::ShellCommand(HDDTEMP_PATH).firsLine().c_str();
+/**
+ * Finds hddtemp binary on the system binaries directories. The user PATH is
+ * not used, fanControl runs hddtemp as root.
+ *
+ * @return {string} : hddtemp binary path or "" if not found
+ */
+static string findHddtemp() {
+  const char *dirs[] = {"/usr/local/sbin/", "/usr/local/bin/", "/usr/sbin/",
+                        "/usr/bin/",        "/sbin/",          "/bin/"};
+
+  for (unsigned int i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+    string bin = string(dirs[i]) + "hddtemp";
+    if (access(bin.c_str(), X_OK) == 0 && isTrusted(bin)) return bin;
+  }
+
+  return "";
+}
+
+/**
+ * Trims blanks around a string, like sysfs disks attributes padding
+ *
+ * @param  {string} str : String to trim
+ *
+ * @return {string}     : Trimmed string
+ */
+static string trim(string str) {
+  size_t start = str.find_first_not_of(" \t");
+  size_t end   = str.find_last_not_of(" \t");
+  return start == string::npos ? "" : str.substr(start, end - start + 1);
+}
+
+const string HWMON_CLASS_DIR = "/sys/class/hwmon/";
+const string BLOCK_CLASS_DIR = "/sys/block/";
+
+const string THERMAL_CLASS_DIR = "/sys/class/thermal/";
+
+/**
+ * hddtemp binary path, searched the first time a disk sensor needs it, so
+ * commands without sensors don't pay for it.
+ *
+ * @return {string} : hddtemp binary path or "" if not found
+ */
+string hddtempBin() {
+  static const string bin = findHddtemp();
+  return bin;
+}
 
 Sensor::Sensor(string devName, string path, string name, string label, int minT,
                int maxT, int offsetT, string cLabel, int type)
@@ -34,7 +90,7 @@ Sensor::Sensor(string devName, string path, string name, string label, int minT,
       minT(minT < 1000 ? minT * 1000 : minT),
       maxT(maxT < 1000 ? maxT * 1000 : maxT),
       offsetT(offsetT < 1000 ? offsetT * 1000 : offsetT), cLabel(cLabel),
-      type(type) {}
+      missing(false), type(type) {}
 Sensor::~Sensor() {}
 
 string Sensor::getLabel() const { return label; }
@@ -65,7 +121,18 @@ void Sensor::setCLabel(string _cLabel) { cLabel = _cLabel; }
 void Sensor::setName(string _name) { name = _name; }
 void Sensor::setDevName(string _devName) { devName = _devName; }
 
-int Sensor::update(int ambT) { return tempPerc = tempPercentage(ambT); }
+bool Sensor::isMissing() const { return missing; }
+void Sensor::setMissing(bool _missing) { missing = _missing; }
+
+int Sensor::update(int ambT, bool read) {
+  return tempPerc = tempPercentage(ambT, read);
+}
+
+SysfsFile *Sensor::getInputFile() { return nullptr; }
+bool       Sensor::isStale() const { return false; }
+bool       Sensor::isIdle() const { return false; }
+bool       Sensor::pollIdle() { return false; }
+bool       Sensor::rebind(string _path) { return false; }
 
 /**
  * Sensors abstract class.
@@ -75,12 +142,15 @@ int Sensor::update(int ambT) { return tempPerc = tempPercentage(ambT); }
  *
  * Calcule percentage on the range of temperatures
  *
- * @param  {int} ambT   : Ambient temperature
+ * Stale and missing sensors return 100% so the fan goes to a safe speed.
+ *
+ * @param  {int}  ambT : Ambient temperature
+ * @param  {bool} read : Reads the sensor, false to use the last value readed
  *
- * @return {int}        : Percentage on the range
+ * @return {int}       : Percentage on the range
  */
-int Sensor::tempPercentage(int ambT) {
-  if (readTemp() >= maxT) return 100;
+int Sensor::tempPercentage(int ambT, bool read) {
+  if ((read ? readTemp() : temp) >= maxT || isStale() || missing) return 100;
 
   int minTemp = max(ambT + offsetT, minT);
 
@@ -110,6 +180,32 @@ void Fan::setlabel(string _label) { label = _label; }
 void Fan::setCLabel(string _cLabel) { cLabel = _cLabel; }
 void Fan::setDevName(string _devName) { devName = _devName; }
 
+SysfsFile *Fan::getOutputFile() { return nullptr; }
+int        Fan::toOutput(int _speed) const { return _speed; }
+void       Fan::setOutput(int _speed, int value) { setSpeed(_speed); }
+
+bool   Fan::isCalibrated() const { return true; }
+bool   Fan::calibrate() { return true; }
+string Fan::getCalibration() const { return ""; }
+bool   Fan::setCalibration(string calibration) { return false; }
+bool   Fan::rebind(string _path) { return false; }
+
+/**
+ * Fans abstract class function. Takes the control of the fan from another
+ * object of the same fan, built from a previous config. Derived classes take
+ * the manual mode too, so deleting the other object doesn't give the fan
+ * back to the firmware.
+ *
+ * @class  Fan
+ * @public Fan::takeOver
+ *
+ * @param  {Fan*} from : Fan object controlling the fan
+ */
+void Fan::takeOver(Fan *from) { speed = from->speed; }
+
+string Fan::getControl() const { return ""; }
+bool   Fan::setControl(string control) { return false; }
+
 /**
  * hwmon Sensor class constructor.
  *
@@ -128,380 +224,2205 @@ HwMonSensor::HwMonSensor(string devName, string path, string name, int minT,
                          int maxT, int offsetT, string label, string cLabel)
     : Sensor(devName, checkDir(path), name, label, minT, maxT, offsetT, cLabel,
              hwmon),
-      pInput(path + name + "_input") {
+      fInput(path + name + "_input") {
   if (label == "") {
-    ShellCommand shell;
-    if (shell.exec(CAT(path + name + "_label"))) {
-      label = shell.firsLine();
-      while (label[label.size() - 1] == ' ')
-        label = label.substr(0, label.size() - 1);
-      setLabel(label);
-    } else
-      setLabel(name);
+    label = readFile(path + name + "_label", true);
+    while (label != "" && label[label.size() - 1] == ' ')
+      label = label.substr(0, label.size() - 1);
+    setLabel(label == "" ? name : label);
   }
   if (cLabel == "") setCLabel(devName + "_" + getLabel());
-  readTemp();
 }
 HwMonSensor::~HwMonSensor() {}
 
-string HwMonSensor::getInputPath() const { return pInput; }
+string HwMonSensor::getInputPath() const { return fInput.getPath(); }
 
-int HwMonSensor::readTemp() { return temp = stoi(readFile(pInput)); }
+int        HwMonSensor::readTemp() { return temp = fInput.readInt(); }
+SysfsFile *HwMonSensor::getInputFile() { return &fInput; }
 
 /**
- * hddtemp Sensor class constructor.
+ * hwmon Sensor class function. Moves the sensor to another hwmon directory,
+ * used when its device is rebound. The path is kept while unbound, so the
+ * config still has it.
  *
- * @class  HddTempSensor : public Sensor
- * @public HddTempSensor::HddTempSensor
+ * @class  HwMonSensor : public Sensor
+ * @public HwMonSensor::rebind
  *
- * @param  {string} name    : Disk name
- * @param  {int} minT       : Minimum working temperature
- * @param  {int} maxT       : Maximum working temperature
- * @param  {int} offsetT    : Offset temperatur
- * @param  {string} cLabel  : Custo label
+ * @param  {string} _path : New hwmon directory, "" while the device is gone
+ *
+ * @return {bool}         : True, hwmon sensors can always be rebound
  */
-HddTempSensor::HddTempSensor(string name, int minT, int maxT, int offsetT,
-                             string cLabel, string path)
-    : Sensor("hddTemp", path == "" ? HDDTEMP_BIN : path, name,
-             ShellCommand(DISK_MODEL(name)).firsLine(), minT, maxT, offsetT,
-             cLabel, hddtemp),
-      cInput(path == "" ? HDDTEMP_BIN + " /dev/" + name + E_NULL HDDTEMP_SED
-                        : path + " /dev/" + name + E_NULL        HDDTEMP_SED) {
-  if (cLabel == "") setCLabel(devName + "_" + label);
-  readTemp();
+bool HwMonSensor::rebind(string _path) {
+  if (_path != "") path = checkDir(_path);
+  fInput.setPath(_path == "" ? "" : path + name + "_input");
+  return true;
 }
-HddTempSensor::~HddTempSensor() {}
 
 /**
- * hddtemp Sensor class function.
- *
- * @class  HddTempSensor : public Sensor
- * @public HddTempSensor::readTemp
+ * Steady clock milliseconds, used to timestamp samples
  *
- * @return {int} : Current temperature
+ * @return {long long} : Milliseconds
  */
-int HddTempSensor::readTemp() {
-  return temp = stoi("0" + ShellCommand(cInput).firsLine()) * 1000;
+static long long steadyMs() {
+  return chrono::duration_cast<chrono::milliseconds>(
+             chrono::steady_clock::now().time_since_epoch())
+      .count();
 }
 
 /**
- * hwmon Fan class constructor.
+ * Thermal zone Sensor class constructor.
  *
- * @class  HwMonSensor : public Fan
- * @public HwMonFan::HwMonFan
+ * @class  ThermalZoneSensor : public Sensor
+ * @public ThermalZoneSensor::ThermalZoneSensor
  *
- * @param  {string} devName  : hwmon device name (ex: applesmc)
- * @param  {string} path     : Directory path
- * @param  {string} fileName : Fan file name without suffix (_label|_input...)
- * @param  {string} cLabel   : Fan custom label
+ * @param  {string} path    : Zone directory path
+ * @param  {string} name    : Zone directory name (ex: thermal_zone0)
+ * @param  {int} minT       : Minimum working temperature
+ * @param  {int} maxT       : Maximum working temperature
+ * @param  {int} offsetT    : Offset temperatur
+ * @param  {string} cLabel  : Custom label
+ * @param  {string} label   : Zone type, readed from the zone if empty
  */
-HwMonFan::HwMonFan(string devName, string path, string fileName, string cLabel)
-    : Fan(devName, stoi(readFile(checkDir(path) + fileName + "_min")),
-          stoi(readFile(path + fileName + "_max")),
-          readFile(path + fileName + "_label"), cLabel, hwmon),
-      path(path), fileName(fileName), pInput(path + fileName + "_input"),
-      pOutput(path + fileName + "_output"),
-      pManual(path + fileName + "_manual"), manModeStat(false) {
-  while (label[label.size() - 1] == ' ')
-    label = label.substr(0, label.size() - 1);
-  if (cLabel == "") setCLabel(label + " " + devName);
+ThermalZoneSensor::ThermalZoneSensor(string path, string name, int minT,
+                                     int maxT, int offsetT, string cLabel,
+                                     string label)
+    : Sensor("thermal", checkDir(path), name,
+             label == "" ? trim(readFile(checkDir(path) + "type", true))
+                         : label,
+             minT, maxT, offsetT, cLabel, thermal),
+      fInput(this->path + "temp") {
+  if (this->label == "") setLabel(name);
+  if (cLabel == "") setCLabel(devName + "_" + this->label);
 }
+ThermalZoneSensor::~ThermalZoneSensor() {}
 
-HwMonFan::~HwMonFan() { manualModeOff(); }
+int        ThermalZoneSensor::readTemp() { return temp = fInput.readInt(); }
+SysfsFile *ThermalZoneSensor::getInputFile() { return &fInput; }
 
 /**
- * hwmon Fan class function.
+ * IPMI Sensor class constructor.
  *
- * @class   HwMonSensor : public Fan
- * @private HwMonFan::manualMode
+ * @class  IpmiSensor : public Sensor
+ * @public IpmiSensor::IpmiSensor
  *
- * @param  {bool} mode : On off switcher
+ * @param  {string} name    : SDR sensor name (ex: Inlet Temp)
+ * @param  {int} minT       : Minimum working temperature
+ * @param  {int} maxT       : Maximum working temperature
+ * @param  {int} offsetT    : Offset temperatur
+ * @param  {string} cLabel  : Custom label
+ * @param  {string} args    : ipmitool interface options, "" for the local BMC
  */
-void HwMonFan::manualMode(bool mode) {
-  if (mode != manModeStat) {
-    writeFile(pManual, mode ? "1" : "0");
-    manModeStat = mode;
-  }
+IpmiSensor::IpmiSensor(string name, int minT, int maxT, int offsetT,
+                       string cLabel, string args)
+    : Sensor("ipmi", args, name, name, minT, maxT, offsetT, cLabel, ipmi),
+      session(IpmiSession::get(args)), readAt(0) {
+  session->addSensor(name);
+  if (cLabel == "") setCLabel(devName + "_" + label);
+  temp = 0;
 }
+IpmiSensor::~IpmiSensor() {}
 
-string HwMonFan::getPath() const { return path; }
-string HwMonFan::getName() const { return fileName; }
+int IpmiSensor::readTemp() {
+  double value;
 
-void HwMonFan::manualModeOn() { manualMode(true); }
-void HwMonFan::manualModeOff() { manualMode(false); }
+  if (session->getReading(name, value)) {
+    temp   = value * 1000;
+    readAt = steadyMs();
+  }
+
+  return temp;
+}
 
-int HwMonFan::readSpeed() { return stoi(readFile(pInput)); }
+bool IpmiSensor::isStale() const { return steadyMs() - readAt > STALE_LIMIT; }
 
 /**
- * Changes current fan speed
+ * External Sensor class constructor.
  *
- * @class  HwMonSensor : public Fan
- * @public HwMonFan::changeSpeed
+ * @class  ExecSensor : public Sensor
+ * @public ExecSensor::ExecSensor
  *
- * @param  {int} newSpeed : New fan speed
+ * @param  {string} id      : Sensor id on the helper
+ * @param  {string} command : Helper command line
+ * @param  {int} minT       : Minimum working temperature
+ * @param  {int} maxT       : Maximum working temperature
+ * @param  {int} offsetT    : Offset temperatur
+ * @param  {string} cLabel  : Custom label
+ * @param  {string} label   : Sensor label, the id if empty
  */
-void HwMonFan::changeSpeed(int newSpeed) {
-  if (manModeStat && newSpeed != speed) {
-    writeFile(pOutput, to_string(newSpeed));
-    setSpeed(newSpeed);
-  }
+ExecSensor::ExecSensor(string id, string command, int minT, int maxT,
+                       int offsetT, string cLabel, string label)
+    : Sensor("exec", command, id, label == "" ? id : label, minT, maxT,
+             offsetT, cLabel, exec),
+      helper(ExecHelper::get(command)), readAt(0) {
+  helper->addSensor(id);
+  if (cLabel == "") setCLabel(devName + "_" + this->label);
+  temp = 0;
 }
+ExecSensor::~ExecSensor() {}
 
-FanNode::FanNode(Fan *fan, sensors_vp *sens) : fan(fan), sensors(sens) {}
-FanNode::~FanNode() {}
+int ExecSensor::readTemp() {
+  int value;
 
-Fan *       FanNode::getFan() const { return fan; }
-sensors_vp *FanNode::getSensors() const { return sensors; }
+  if (helper->getReading(name, value)) {
+    temp   = value;
+    readAt = steadyMs();
+  }
 
-void FanNode::setFan(Fan *_fan) { fan = _fan; }
-void FanNode::setSensors(sensors_vp *_sensors, bool clearBefore) {
-  if (clearBefore) clearSensors();
-  delete sensors;
-  sensors = _sensors;
+  return temp;
 }
 
-void FanNode::pushBackSensor(Sensor *sensor) { sensors->push_back(sensor); }
-void FanNode::popBackSensor() { sensors->pop_back(); }
+bool ExecSensor::isStale() const { return steadyMs() - readAt > STALE_LIMIT; }
 
-/**
- * Generic fan node class function. Deletes all sensors
- *
- * @class  FanNode
- * @public FanNode::clearSensors
- */
-void FanNode::clearSensors() {
-  int senSize = sensors->size();
+// Loaded plugin or throw, plugins devices can't be built without it
+static PluginHost *loadPlugin(string path) {
+  PluginHost *host = PluginHost::get(path);
 
-  if (senSize > 0)
-    for (int i = 0; i < senSize; i++) {
-      delete (*sensors)[i];
-      (*sensors)[i] = nullptr;
-    }
+  if (!host) throw runtime_error("Plugin not loaded: " + path);
 
-  sensors->clear();
+  return host;
 }
 
 /**
- * Generic fan node class function.
+ * Plugin Sensor class constructor.
  *
- * @class  FanNode
- * @public FanNode::getMaxPercentage
+ * @class  PluginSensor : public Sensor
+ * @public PluginSensor::PluginSensor
  *
- * @param  {int} ambT : Ambient temperature
- * @return {int}      : Maximum percentage range from all sensors
+ * @param  {string} id      : Sensor id on the plugin
+ * @param  {string} path    : Plugin file path
+ * @param  {int} minT       : Minimum working temperature
+ * @param  {int} maxT       : Maximum working temperature
+ * @param  {int} offsetT    : Offset temperatur
+ * @param  {string} cLabel  : Custom label
+ * @param  {string} label   : Sensor label, the discovered one if empty
  */
-int FanNode::getMaxPercentage(int ambT) {
-  int senSize = sensors->size();
-  int maxPerc = 0;
+PluginSensor::PluginSensor(string id, string path, int minT, int maxT,
+                           int offsetT, string cLabel, string label)
+    : Sensor(loadPlugin(path)->getName(), path, id, label == "" ? id : label,
+             minT, maxT, offsetT, cLabel, plugin),
+      host(loadPlugin(path)), handle(host->openDevice(id)), readAt(0) {
+  fc_device device;
 
-  if (senSize > 0)
-    for (int i = 0; i < senSize; i++)
-      maxPerc = max((*sensors)[i]->update(ambT), maxPerc);
+  if (handle < 0) throw runtime_error("Plugin device not found: " + id);
 
-  return maxPerc;
+  if (label == "" && host->findDevice(id, device) && device.label[0])
+    this->label = device.label;
+
+  host->addSensor(handle);
+  if (cLabel == "") setCLabel(devName + "_" + this->label);
+  temp = 0;
 }
+PluginSensor::~PluginSensor() {}
+
+int PluginSensor::readTemp() {
+  int value;
+
+  if (host->getReading(handle, value)) {
+    temp   = value;
+    readAt = steadyMs();
+  }
+
+  return temp;
+}
+
+bool PluginSensor::isStale() const {
+  return steadyMs() - readAt > STALE_LIMIT;
+}
+
+SampledSensor::SampledSensor(string devName, string path, string name,
+                             string label, int minT, int maxT, int offsetT,
+                             string cLabel, int type)
+    : Sensor(devName, path, name, label, minT, maxT, offsetT, cLabel, type),
+      sampled(0), sampledAt(0), async(false), idle(false), staleLimit(0) {
+  temp = 0;
+}
+SampledSensor::~SampledSensor() {}
+
+void SampledSensor::setAsync(bool _async) { async = _async; }
+void SampledSensor::setStaleLimit(int _staleLimit) { staleLimit = _staleLimit; }
 
 /**
- * Generic fan node class function. Updates the fan speed
+ * Slow sensors abstract class function.
+ * Reads the device and publishes the value with its timestamp. A failed read
+ * publishes nothing, so the last sample ages until it is stale.
  *
- * @class  FanNode
- * @public FanNode::update
+ * @class  SampledSensor : public Sensor
+ * @public SampledSensor::sample
  *
- * @param  {int} ambT : Ambient temperature
+ * @return {int} : Last temperature sampled
  */
-void FanNode::update(int ambT) {
-  int minS  = fan->getMinS();
-  int maxS  = fan->getMaxS();
-  int maxP  = getMaxPercentage(ambT);
-  int speed = minS + ((maxS - minS) * maxP / 100);
+int SampledSensor::sample() {
+  int value = sampled;
 
-  if (speed != fan->getSpeed()) fan->changeSpeed(speed);
-}
+  if (sampleTemp(value)) {
+    sampled   = value;
+    sampledAt = steadyMs();
+  }
 
-FanController::FanController(fanNode_vp *fans, Sensor *ambSensor)
-    : ambSensor(nullptr), fans(!fans ? new fanNode_vp : fans), working(false),
-      worker(nullptr) {}
-FanController::FanController(Sensor *ambSensor, fanNode_vp *fans)
-    : ambSensor(ambSensor), fans(!fans ? new fanNode_vp : fans), working(false),
-      worker(nullptr) {}
-FanController::FanController(FanController *fanCtl)
-    : ambSensor(fanCtl->getAmbSensor()), fans(fanCtl->getFans()),
-      working(false), worker(nullptr) {}
+  return sampled;
+}
 
 /**
- * Fans controller class destructor.
+ * Slow sensors abstract class function.
+ * Returns the last published value when sampled asynchronously, otherwise
+ * reads the device.
  *
- * @class FanController
- * @public FanController::~FanController
+ * @class  SampledSensor : public Sensor
+ * @public SampledSensor::readTemp
+ *
+ * @return {int} : Current temperature
  */
-FanController::~FanController() {
-  if (worker || working) {
-    stopWorker();
-    delete worker;
-    worker = nullptr;
-  }
+int SampledSensor::readTemp() {
+  return temp = async ? sampled.load() : sample();
 }
 
 /**
- * Fans controller class static function. Thread worker loop.
+ * Slow sensors abstract class function.
+ * Publishes a temperature sampled before, by a previous fanControl process,
+ * it is stale as soon as a sample that old would be.
  *
- * @class   FanController
- * @private FanController::threadLoop
+ * @class  SampledSensor : public Sensor
+ * @public SampledSensor::resume
  *
- * @param  {FanController*} _this : Pointer FanController
+ * @param  {int} value : Temperature sampled
+ * @param  {int} age   : Sample age in milliseconds
  */
-void FanController::threadLoop(FanController *_this) {
-  fanNode_vp *fans = _this->fans;
-  int         fansSize;
-
-  while (_this && _this->working && (fansSize = fans->size()) > 0) {
-    int ambT = !_this->ambSensor ? 0 : _this->ambSensor->readTemp();
-    for (unsigned int i = 0; i < fansSize; i++) (*fans)[i]->update(ambT);
-    this_thread::sleep_for(chrono::seconds(1));
-  }
+void SampledSensor::resume(int value, int age) {
+  temp      = value;
+  sampled   = value;
+  sampledAt = steadyMs() - age;
 }
 
-Sensor *    FanController::getAmbSensor() const { return ambSensor; }
-fanNode_vp *FanController::getFans() const { return fans; }
-
-thread *FanController::getWorker() { return worker; }
+// Milliseconds since the last sample, -1 if it was never sampled
+int SampledSensor::getSampleAge() const {
+  long long age = steadyMs() - sampledAt;
 
-void FanController::setAmbSensor(Sensor *_ambSensor, bool delBefore) {
-  if (delBefore && ambSensor) delete ambSensor;
-  ambSensor = _ambSensor;
+  return sampledAt == 0 ? -1 : age < INT_MAX ? age : INT_MAX;
 }
-void FanController::setFans(fanNode_vp *_fans, bool delBefore) {
-  if (delBefore && fans) delete fans;
-  fans = _fans;
+
+/**
+ * Slow sensors abstract class function.
+ * Only good reads are timestamped, a failing device turns stale also when it
+ * is readed synchronously.
+ *
+ * @class  SampledSensor : public Sensor
+ * @public SampledSensor::isStale
+ *
+ * @return {bool} : True if the last sample is older than the limit
+ */
+bool SampledSensor::isStale() const {
+  return staleLimit > 0 && steadyMs() - sampledAt > staleLimit;
 }
 
-void FanController::pushBackFanNode(FanNode *node) { fans->push_back(node); }
-void FanController::popBackFanNode() { fans->pop_back(); }
+bool SampledSensor::isIdle() const { return idle; }
 
 /**
- * Fans controller class function.
- * Starts the worker wich controlls fans speeds.
+ * Slow sensors abstract class function.
+ * The idle state is refreshed by sampleTemp(). When sampled synchronously the
+ * sensor must still be readed so sampleTemp() can check it again.
  *
- * @class  FanController
- * @public FanController::startWorker
+ * @class  SampledSensor : public Sensor
+ * @public SampledSensor::pollIdle
+ *
+ * @return {bool} : True if the device was sleeping on the last sample
  */
-void FanController::startWorker() {
-  int fansSize = fans->size();
+bool SampledSensor::pollIdle() { return async && idle; }
 
-  if (!working && fansSize > 0 && !worker) {
-    for (unsigned int i = 0; i < fansSize; i++)
-      fans->at(i)->getFan()->manualModeOn();
-
-    working = true;
-    worker  = new thread(threadLoop, this);
-  }
+/**
+ * Disk hwmon Sensor class constructor.
+ *
+ * @class  DriveTempSensor : public HwMonSensor
+ * @public DriveTempSensor::DriveTempSensor
+ *
+ * @param  {string} disk    : Disk name (ex: sda)
+ * @param  {string} path    : Disk hwmon directory path
+ * @param  {int} minT       : Minimum working temperature
+ * @param  {int} maxT       : Maximum working temperature
+ * @param  {int} offsetT    : Offset temperatur
+ * @param  {string} cLabel  : Custom label
+ * @param  {string} label   : Disk model, readed from sysfs if empty
+ */
+DriveTempSensor::DriveTempSensor(string disk, string path, int minT, int maxT,
+                                 int offsetT, string cLabel, string label)
+    : HwMonSensor(disk, path, "temp1", minT, maxT, offsetT,
+                  label == "" ? Disks::readModel(disk) : label,
+                  cLabel),
+      fPower(BLOCK_CLASS_DIR + disk + "/device/power/runtime_status"),
+      idle(false) {
+  type = drivetemp;
+  if (getLabel() == "") setLabel(disk);
 }
+DriveTempSensor::~DriveTempSensor() {}
 
 /**
- * Fans controller class function.
- * Stops the worker wich controlls fans speeds.
+ * Disk hwmon Sensor class function. Keeps the last temperature while the disk
+ * is suspended, reading it would spin it up on some controllers.
  *
- * @class  FanController
- * @public FanController::stopWorker
+ * @class  DriveTempSensor : public HwMonSensor
+ * @public DriveTempSensor::readTemp
+ *
+ * @return {int} : Current temperature
  */
-void FanController::stopWorker() {
-  if (working || worker) {
-    working = false;
-
-    if (worker) {
-      worker->join();
-      delete worker;
-      worker = nullptr;
-    }
-
-    int fansSize = fans->size();
-    for (int i = 0; i < fansSize; i++) fans->at(i)->getFan()->manualModeOff();
-  }
+int DriveTempSensor::readTemp() {
+  return pollIdle() ? temp : HwMonSensor::readTemp();
 }
 
-void FanController::clearFans() {
-  int fansSize = fans->size();
-
-  for (int i = 0; i < fans->size(); i++) {
-    (*fans)[i]->clearSensors();
-    delete (*fans)[i]->getFan();
-    (*fans)[i]->setFan(nullptr);
-    delete (*fans)[i];
-    (*fans)[i] = nullptr;
-    fans->clear();
-  }
+SysfsFile *DriveTempSensor::getInputFile() {
+  return idle ? nullptr : HwMonSensor::getInputFile();
 }
 
-void FanController::clearAll() {
-  if (fans) clearFans();
-  if (ambSensor) delete ambSensor;
-  ambSensor = nullptr;
-}
+bool DriveTempSensor::isIdle() const { return idle; }
 
 /**
- * hddtemp device struct constructor.
+ * Disk hwmon Sensor class function. Checks the disk runtime power status.
  *
- * @struct Disks
- * @public Disks::Disks
+ * @class  DriveTempSensor : public HwMonSensor
+ * @public DriveTempSensor::pollIdle
  *
- * @param  {string} disk : Disk name. Example: sda | sdb | hda...
+ * @return {bool} : True if the disk is suspended
  */
-Disks::Disks(string disk) : disk(disk) {
-  ShellCommand shell(DISK_INFO_PF + disk + DISK_INFO_SF);
-
-  if (shell.getSize() < 2) throw runtime_error("Can't read disk info");
-
-  device = "/dev" + disk;
-  serial = shell.firsLine();
-  model  = shell.lastLine();
-}
-
-Disks::~Disks() {}
+bool DriveTempSensor::pollIdle() { return idle = Disks::isSuspended(fPower); }
 
 /**
- * hwmon device struct constructor.
+ * hddtemp Sensor class constructor.
  *
- * @struct HwmonDevice
- * @public HwmonDevice::HwmonDevice
+ * @class  HddTempSensor : public Sensor
+ * @public HddTempSensor::HddTempSensor
  *
- * @param  {string} path : hwmon device driver path
+ * @param  {string} name    : Disk name
+ * @param  {int} minT       : Minimum working temperature
+ * @param  {int} maxT       : Maximum working temperature
+ * @param  {int} offsetT    : Offset temperatur
+ * @param  {string} cLabel  : Custo label
+ * @param  {string} path    : hddtemp binary path
+ * @param  {string} label   : Disk model, readed from sysfs if empty
  */
-HwmonDevice::HwmonDevice(string path) : path(checkDir(path)) {
-  ShellCommand shell;
-  string       lineComm = "";
+HddTempSensor::HddTempSensor(string name, int minT, int maxT, int offsetT,
+                             string cLabel, string path, string label)
+    : SampledSensor("hddTemp", path == "" ? hddtempBin() : path, name,
+                    label == "" ? Disks::readModel(name) : label, minT, maxT,
+                    offsetT, cLabel, hddtemp),
+      cInput(HDDTEMP_READ(this->path, name)),
+      fPower(BLOCK_CLASS_DIR + name + "/device/power/runtime_status") {
+  if (cLabel == "") setCLabel(devName + "_" + this->label);
+}
+HddTempSensor::~HddTempSensor() {}
+
+/**
+ * hddtemp Sensor class function.
+ * hddtemp is not run while the disk is suspended. hddtemp itself checks the
+ * power mode and answers "drive is sleeping" (or "SLP") without waking it,
+ * in both cases the last temperature is kept as a good sample.
+ *
+ * @class   HddTempSensor : public SampledSensor
+ * @private HddTempSensor::sampleTemp
+ *
+ * @param  {int&} value : Where to store the temperature, kept if idle
+ *
+ * @return {bool}       : False if the disk couldn't be readed
+ */
+bool HddTempSensor::sampleTemp(int &value) {
+  if ((idle = Disks::isSuspended(fPower))) return true;
+
+  ShellCommand shell(cInput);
+  string       line = shell.firsLine();
+  int          read = 0;
+
+  idle = line.find("SLP") != string::npos ||
+         line.find("sleeping") != string::npos ||
+         shell.getStderr().find("sleeping") != string::npos;
+
+  if (idle) return true;
+  if (!SysfsFile::parseInt(line.c_str(), line.size(), read)) return false;
+
+  value = read * 1000;
+  return true;
+}
+
+/**
+ * hddtemp daemon Sensor class constructor.
+ *
+ * @class  HddTempDSensor : public Sensor
+ * @public HddTempDSensor::HddTempDSensor
+ *
+ * @param  {string} name    : Disk name
+ * @param  {int} minT       : Minimum working temperature
+ * @param  {int} maxT       : Maximum working temperature
+ * @param  {int} offsetT    : Offset temperatur
+ * @param  {string} cLabel  : Custo label
+ * @param  {string} address : hddtemp daemon address
+ * @param  {string} _label  : Disk model, asked to the daemon if empty
+ */
+HddTempDSensor::HddTempDSensor(string name, int minT, int maxT, int offsetT,
+                               string cLabel, string address, string _label)
+    : SampledSensor("hddTempD", address == "" ? HDDTEMPD_ADDR : address,
+                    name, _label, minT, maxT, offsetT, cLabel, hddtempd),
+      daemon(HddTempDaemon::get(path)), device("/dev/" + name) {
+  HddTempDaemon::Record record;
+
+  if (label == "")
+    setLabel(daemon->getRecord(device, record) ? record.model : name);
+
+  if (cLabel == "") setCLabel(devName + "_" + label);
+}
+HddTempDSensor::~HddTempDSensor() {}
+
+/**
+ * hddtemp daemon Sensor class function.
+ * All the disks on the daemon are fetched once per tick, later sensors
+ * reuse the records. A sleeping disk keeps the last temperature.
+ *
+ * @class   HddTempDSensor : public SampledSensor
+ * @private HddTempDSensor::sampleTemp
+ *
+ * @param  {int&} value : Where to store the temperature, kept if sleeping
+ *
+ * @return {bool}       : False if the daemon has no temperature for the disk
+ */
+bool HddTempDSensor::sampleTemp(int &value) {
+  HddTempDaemon::Record record;
+
+  if (!daemon->getRecord(device, record)) return false;
+
+  if ((idle = record.sleeping)) return true;
+  if (!record.valid) return false;
+
+  value = record.temp;
+  return true;
+}
+
+/**
+ * hwmon Fan class constructor.
+ *
+ * @class  HwMonSensor : public Fan
+ * @public HwMonFan::HwMonFan
+ *
+ * @param  {string} devName  : hwmon device name (ex: applesmc)
+ * @param  {string} path     : Directory path
+ * @param  {string} fileName : Fan file name without suffix (_label|_input...)
+ * @param  {string} cLabel   : Fan custom label
+ * @param  {string} label    : Fan label, readed from sysfs if empty
+ * @param  {int}    minS     : Minimum speed, readed from sysfs if negative
+ * @param  {int}    maxS     : Maximum speed, readed from sysfs if negative
+ */
+HwMonFan::HwMonFan(string devName, string path, string fileName, string cLabel,
+                   string label, int minS, int maxS)
+    : Fan(devName,
+          minS < 0 ? stoi(readFile(checkDir(path) + fileName + "_min")) : minS,
+          maxS < 0 ? stoi(readFile(checkDir(path) + fileName + "_max")) : maxS,
+          label == "" ? readFile(checkDir(path) + fileName + "_label") : label,
+          cLabel, hwmon),
+      path(checkDir(path)), fileName(fileName),
+      fInput(path + fileName + "_input"),
+      fOutput(path + fileName + "_output", O_WRONLY),
+      fManual(path + fileName + "_manual", O_WRONLY), manModeStat(false) {
+  while (this->label != "" && this->label[this->label.size() - 1] == ' ')
+    this->label = this->label.substr(0, this->label.size() - 1);
+  if (cLabel == "") setCLabel(this->label + " " + devName);
+}
+
+HwMonFan::~HwMonFan() { manualModeOff(); }
+
+/**
+ * hwmon Fan class function.
+ *
+ * @class   HwMonSensor : public Fan
+ * @private HwMonFan::manualMode
+ *
+ * @param  {bool} mode : On off switcher
+ */
+void HwMonFan::manualMode(bool mode) {
+  if (mode != manModeStat) {
+    fManual.writeInt(mode ? 1 : 0);
+    manModeStat = mode;
+  }
+}
+
+string HwMonFan::getPath() const { return path; }
+string HwMonFan::getName() const { return fileName; }
+
+void HwMonFan::manualModeOn() { manualMode(true); }
+void HwMonFan::manualModeOff() { manualMode(false); }
+
+int HwMonFan::readSpeed() { return fInput.readInt(); }
+
+/**
+ * Changes current fan speed
+ *
+ * @class  HwMonSensor : public Fan
+ * @public HwMonFan::changeSpeed
+ *
+ * @param  {int} newSpeed : New fan speed
+ */
+void HwMonFan::changeSpeed(int newSpeed) {
+  if (manModeStat && newSpeed != speed && fOutput.writeInt(newSpeed))
+    setSpeed(newSpeed);
+}
+
+SysfsFile *HwMonFan::getOutputFile() {
+  return manModeStat ? &fOutput : nullptr;
+}
+
+/**
+ * hwmon Fan class function. Moves the fan to another hwmon directory. A new
+ * device starts on automatic mode, so manual mode is taken again and the
+ * speed written on the next tick.
+ *
+ * @class  HwMonFan : public Fan
+ * @public HwMonFan::rebind
+ *
+ * @param  {string} _path : New hwmon directory, "" while the device is gone
+ *
+ * @return {bool}         : True, hwmon fans can always be rebound
+ */
+bool HwMonFan::rebind(string _path) {
+  bool manual = manModeStat;
+
+  if (_path != "") path = checkDir(_path);
+
+  fInput.setPath(_path == "" ? "" : path + fileName + "_input");
+  fOutput.setPath(_path == "" ? "" : path + fileName + "_output");
+  fManual.setPath(_path == "" ? "" : path + fileName + "_manual");
+
+  setSpeed(-1);
+  if (_path != "" && manual) {
+    manModeStat = false;
+    manualMode(true);
+  }
+
+  return true;
+}
+
+void HwMonFan::takeOver(Fan *from) {
+  HwMonFan *fan = dynamic_cast<HwMonFan *>(from);
+
+  Fan::takeOver(from);
+  if (!fan) return;
+
+  manModeStat      = fan->manModeStat;
+  fan->manModeStat = false;
+}
+
+/**
+ * hwmon PWM Fan class constructor.
+ *
+ * @class  PwmFan : public Fan
+ * @public PwmFan::PwmFan
+ *
+ * @param  {string} devName  : hwmon device name (ex: nct6775)
+ * @param  {string} path     : Directory path
+ * @param  {string} fileName : Fan file name without suffix (ex: fan1)
+ * @param  {string} cLabel   : Custom label
+ * @param  {string} label    : Fan label, readed from sysfs if empty
+ */
+PwmFan::PwmFan(string devName, string path, string fileName, string cLabel,
+               string label)
+    : Fan(devName, 0, 0,
+          label == "" ? readFile(checkDir(path) + fileName + "_label", true)
+                      : label,
+          cLabel, pwm),
+      path(checkDir(path)), fileName(fileName),
+      fInput(path + fileName + "_input"),
+      fPwm(path + "pwm" + fileName.substr(3), O_RDWR),
+      fEnable(path + "pwm" + fileName.substr(3) + "_enable", O_RDWR),
+      stallPwm(0), startPwm(0), lastPwm(-1), autoEnable(2), autoPwm(PWM_MAX),
+      manModeStat(false) {
+  while (this->label != "" && this->label[this->label.size() - 1] == ' ')
+    this->label = this->label.substr(0, this->label.size() - 1);
+  if (this->label == "") this->label = fileName;
+  if (cLabel == "") setCLabel(this->label + " " + devName);
+}
+
+PwmFan::~PwmFan() { manualModeOff(); }
+
+string PwmFan::getPath() const { return path; }
+string PwmFan::getName() const { return fileName; }
+
+/**
+ * hwmon PWM Fan class function. Takes the fan control, the previous control
+ * mode and duty cycle are restored by manualModeOff().
+ *
+ * @class  PwmFan : public Fan
+ * @public PwmFan::manualModeOn
+ */
+void PwmFan::manualModeOn() {
+  if (manModeStat) return;
+
+  if (!fEnable.readInt(autoEnable)) autoEnable = 2;
+  if (!fPwm.readInt(autoPwm)) autoPwm = PWM_MAX;
+
+  manModeStat = fEnable.writeInt(1);
+}
+
+void PwmFan::manualModeOff() {
+  if (!manModeStat) return;
+
+  if (autoEnable == 1) fPwm.writeInt(autoPwm);
+  fEnable.writeInt(autoEnable);
+
+  manModeStat = false;
+  lastPwm     = -1;
+}
+
+int PwmFan::readSpeed() { return fInput.readInt(); }
+
+/**
+ * hwmon PWM Fan class function. Translates a speed to a duty cycle
+ * interpolating the calibration table. Never below the stall duty cycle.
+ *
+ * @class  PwmFan : public Fan
+ * @public PwmFan::dutyFor
+ *
+ * @param  {int} rpm : Target speed
+ *
+ * @return {int}     : Duty cycle, maximum if the fan isn't calibrated
+ */
+int PwmFan::dutyFor(int rpm) const {
+  int   tableSize = table.size();
+  Point prev      = {stallPwm, minS};
+
+  for (int i = 0; i < tableSize; i++) {
+    const Point &point = table[i];
+
+    if (point.pwm <= stallPwm) continue;
+
+    if (point.rpm >= rpm) {
+      if (point.rpm == prev.rpm) return point.pwm;
+
+      return prev.pwm + (point.pwm - prev.pwm) * max(rpm - prev.rpm, 0) /
+                            (point.rpm - prev.rpm);
+    }
+
+    prev = point;
+  }
+
+  return PWM_MAX;
+}
+
+/**
+ * Changes current fan speed
+ *
+ * @class  PwmFan : public Fan
+ * @public PwmFan::changeSpeed
+ *
+ * @param  {int} newSpeed : New fan speed
+ */
+void PwmFan::changeSpeed(int newSpeed) {
+  if (!manModeStat || newSpeed == speed) return;
+
+  int duty = toOutput(newSpeed);
+
+  if (fPwm.writeInt(duty)) setOutput(newSpeed, duty);
+}
+
+SysfsFile *PwmFan::getOutputFile() { return manModeStat ? &fPwm : nullptr; }
+
+/**
+ * hwmon PWM Fan class function. Duty cycle to write for a speed. A stopped
+ * fan gets at least the start duty cycle, the stall one could not spin it up.
+ *
+ * @class  PwmFan : public Fan
+ * @public PwmFan::toOutput
+ *
+ * @param  {int} newSpeed : New fan speed
+ *
+ * @return {int}          : Duty cycle
+ */
+int PwmFan::toOutput(int newSpeed) const {
+  int duty = dutyFor(newSpeed);
+
+  if (lastPwm < stallPwm && duty < startPwm) duty = startPwm;
+
+  return duty;
+}
+
+/**
+ * hwmon PWM Fan class function. Records a duty cycle once it is written, a
+ * failed write leaves the last one so the next start check stays right.
+ *
+ * @class  PwmFan : public Fan
+ * @public PwmFan::setOutput
+ *
+ * @param  {int} newSpeed : Fan speed set
+ * @param  {int} duty     : Duty cycle written
+ */
+void PwmFan::setOutput(int newSpeed, int duty) {
+  lastPwm = duty;
+  setSpeed(newSpeed);
+}
+
+bool PwmFan::isCalibrated() const { return !table.empty(); }
+
+/**
+ * hwmon PWM Fan class function. Sets a duty cycle and measures the speed
+ * once it settles.
+ *
+ * @class   PwmFan : public Fan
+ * @private PwmFan::measure
+ *
+ * @param  {int} duty   : Duty cycle
+ * @param  {int} settle : Milliseconds to wait
+ *
+ * @return {int}        : Speed, -1 on errors
+ */
+int PwmFan::measure(int duty, int settle) {
+  int rpm;
+
+  if (!fPwm.writeInt(duty)) return -1;
+  this_thread::sleep_for(chrono::milliseconds(settle));
+
+  return fInput.readInt(rpm) ? rpm : -1;
+}
+
+/**
+ * hwmon PWM Fan class function. Calibration sweep, takes about a minute.
+ * Measures the speed from the maximum duty cycle down to the one where the
+ * fan stalls, then goes up from there until the fan starts again.
+ *
+ * @class  PwmFan : public Fan
+ * @public PwmFan::calibrate
+ *
+ * @return {bool} : True if the fan was calibrated
+ */
+bool PwmFan::calibrate() {
+  bool          manual = manModeStat;
+  vector<Point> points;
+  int           stall = 0, start = 0, rpm = 0;
+
+  manualModeOn();
+  if (!manModeStat) return false;
+
+  bool measured = measure(PWM_MAX, SETTLE * 2) > 0;
+
+  for (int duty = PWM_MAX; measured && duty >= 0; duty -= CAL_STEP) {
+    if ((rpm = measure(duty, SETTLE)) < 0) measured = false;
+    else {
+      Point point = {duty, rpm};
+      points.insert(points.begin(), point);
+    }
+
+    if (rpm <= 0) break;
+    stall = start = duty;
+  }
+
+  // Stopped, the start duty cycle is usually higher than the stall one
+  if (rpm == 0) start = PWM_MAX;
+
+  for (int duty = stall; measured && rpm == 0 && duty <= PWM_MAX;
+       duty += CAL_STEP)
+    if ((rpm = measure(duty, SETTLE)) < 0) measured = false;
+    else if (rpm > 0)
+      start = duty;
+
+  if (!manual) manualModeOff();
+  else if (lastPwm >= 0)
+    fPwm.writeInt(lastPwm);
+
+  if (!measured) return false;
+
+  table    = points;
+  stallPwm = stall;
+  startPwm = max(start, stall);
+  updateRange();
+
+  return true;
+}
+
+/**
+ * hwmon PWM Fan class function. Speed range from the calibration table, the
+ * stall point speed to the maximum one.
+ *
+ * @class   PwmFan : public Fan
+ * @private PwmFan::updateRange
+ */
+void PwmFan::updateRange() {
+  int tableSize = table.size();
+
+  minS = maxS = 0;
+
+  for (int i = 0; i < tableSize; i++) {
+    if (table[i].pwm == stallPwm) minS = table[i].rpm;
+    maxS = max(maxS, table[i].rpm);
+  }
+}
+
+/**
+ * hwmon PWM Fan class function.
+ * Calibration as "stall start pwm:rpm pwm:rpm...".
+ *
+ * @class  PwmFan : public Fan
+ * @public PwmFan::getCalibration
+ *
+ * @return {string} : Calibration or "" if the fan isn't calibrated
+ */
+string PwmFan::getCalibration() const {
+  ostringstream calibration;
+  int           tableSize = table.size();
+
+  if (tableSize == 0) return "";
+
+  calibration << stallPwm << " " << startPwm;
+  for (int i = 0; i < tableSize; i++)
+    calibration << " " << table[i].pwm << ":" << table[i].rpm;
+
+  return calibration.str();
+}
+
+/**
+ * hwmon PWM Fan class function. Restores a calibration from getCalibration().
+ *
+ * @class  PwmFan : public Fan
+ * @public PwmFan::setCalibration
+ *
+ * @param  {string} calibration : Stored calibration
+ *
+ * @return {bool}               : True if the calibration is valid
+ */
+bool PwmFan::setCalibration(string calibration) {
+  istringstream input(calibration);
+  vector<Point> points;
+  string        token;
+  int           stall, start;
+
+  if (!(input >> stall >> start)) return false;
+
+  while (input >> token) {
+    Point point;
+
+    if (sscanf(token.c_str(), "%d:%d", &point.pwm, &point.rpm) != 2)
+      return false;
+    points.push_back(point);
+  }
+
+  if (points.empty()) return false;
+
+  table    = points;
+  stallPwm = stall;
+  startPwm = start;
+  updateRange();
+
+  return true;
+}
+
+/**
+ * hwmon PWM Fan class function. Moves the fan to another hwmon directory.
+ * Manual mode is taken again on the new device, saving its control state.
+ *
+ * @class  PwmFan : public Fan
+ * @public PwmFan::rebind
+ *
+ * @param  {string} _path : New hwmon directory, "" while the device is gone
+ *
+ * @return {bool}         : True, hwmon fans can always be rebound
+ */
+bool PwmFan::rebind(string _path) {
+  bool   manual = manModeStat;
+  string pwm    = "pwm" + fileName.substr(3);
+
+  if (_path != "") path = checkDir(_path);
+
+  fInput.setPath(_path == "" ? "" : path + fileName + "_input");
+  fPwm.setPath(_path == "" ? "" : path + pwm);
+  fEnable.setPath(_path == "" ? "" : path + pwm + "_enable");
+
+  lastPwm = -1;
+  setSpeed(-1);
+  if (_path != "" && manual) {
+    manModeStat = false;
+    manualModeOn();
+  }
+
+  return true;
+}
+
+// Control state to hand the fan over, "<mode>,<duty cycle>" to restore
+string PwmFan::getControl() const {
+  if (!manModeStat) return "";
+
+  return to_string(autoEnable) + "," + to_string(autoPwm);
+}
+
+/**
+ * hwmon PWM Fan class function. Takes the fan handed over by another
+ * process, already on manual mode, with the control mode and duty cycle it
+ * had before, so manualModeOff() restores them and not the manual mode.
+ *
+ * @class  PwmFan : public Fan
+ * @public PwmFan::setControl
+ *
+ * @param  {string} control : Control state, see getControl()
+ *
+ * @return {bool}           : True if the control state is valid
+ */
+bool PwmFan::setControl(string control) {
+  int enable, pwm;
+
+  if (sscanf(control.c_str(), "%d,%d", &enable, &pwm) != 2) return false;
+
+  autoEnable  = enable;
+  autoPwm     = pwm;
+  lastPwm     = -1;
+  manModeStat = true;
+
+  return true;
+}
+
+/**
+ * hwmon PWM Fan class function. Takes the control of the fan from another
+ * object, with the control state saved when it took manual mode.
+ *
+ * @class  PwmFan : public Fan
+ * @public PwmFan::takeOver
+ *
+ * @param  {Fan*} from : Fan object controlling the fan
+ */
+void PwmFan::takeOver(Fan *from) {
+  PwmFan *fan = dynamic_cast<PwmFan *>(from);
+
+  Fan::takeOver(from);
+  if (!fan) return;
+
+  lastPwm          = fan->lastPwm;
+  autoEnable       = fan->autoEnable;
+  autoPwm          = fan->autoPwm;
+  manModeStat      = fan->manModeStat;
+  fan->manModeStat = false;
+}
+
+const string IpmiFan::MANUAL_ON     = "raw 0x30 0x30 0x01 0x00";
+const string IpmiFan::MANUAL_OFF    = "raw 0x30 0x30 0x01 0x01";
+const string IpmiFan::SET_SPEED     = "raw 0x30 0x30 0x02 {fan} {duty}";
+const string IpmiFan::SET_SPEED_ALL = "raw 0x30 0x30 0x02 0xff {duty}";
+
+// Fan index from the first number on its SDR name (Fan1 is 0), -1 if none
+static int fanIndex(const string &name) {
+  size_t from = name.find_first_of("0123456789");
+  int    number;
+
+  if (from == string::npos || sscanf(name.c_str() + from, "%d", &number) != 1)
+    return -1;
+
+  return number - 1;
+}
+
+/**
+ * IPMI Fan class constructor. The default commands are the Dell PowerEdge
+ * ones, other boards need them on the config.
+ *
+ * @class  IpmiFan : public Fan
+ * @public IpmiFan::IpmiFan
+ *
+ * @param  {string} name   : Fan SDR sensor name (ex: Fan1)
+ * @param  {string} args   : ipmitool interface options, "" for the local BMC
+ * @param  {string} cLabel : Custom label
+ */
+IpmiFan::IpmiFan(string name, string args, string cLabel)
+    : Fan("ipmi", MIN_DUTY, 100, name, cLabel, ipmi),
+      session(IpmiSession::get(args)), name(name), cmdManualOn(MANUAL_ON),
+      cmdManualOff(MANUAL_OFF), cmdSpeed(SET_SPEED), index(fanIndex(name)),
+      manModeStat(false) {
+  if (cLabel == "") setCLabel(label + " " + devName);
+}
+
+IpmiFan::~IpmiFan() { manualModeOff(); }
+
+string IpmiFan::getPath() const { return session->getArgs(); }
+string IpmiFan::getName() const { return name; }
+string IpmiFan::getManualOnCmd() const { return cmdManualOn; }
+string IpmiFan::getManualOffCmd() const { return cmdManualOff; }
+string IpmiFan::getSpeedCmd() const { return cmdSpeed; }
+
+void IpmiFan::setCommands(string manualOn, string manualOff, string speed) {
+  cmdManualOn  = manualOn;
+  cmdManualOff = manualOff;
+  cmdSpeed     = speed;
+}
+
+void IpmiFan::manualModeOn() {
+  if (!manModeStat) manModeStat = session->acquire(cmdManualOn);
+}
+
+void IpmiFan::manualModeOff() {
+  if (manModeStat) manModeStat = !session->release(cmdManualOn, cmdManualOff);
+}
+
+int IpmiFan::readSpeed() {
+  double value;
+  return session->getReading(name, value) ? value : 0;
+}
+
+/**
+ * Changes current fan speed. Nothing is sent if the template needs the fan
+ * index and the name has none, the command would hit another fan.
+ *
+ * @class  IpmiFan : public Fan
+ * @public IpmiFan::changeSpeed
+ *
+ * @param  {int} newSpeed : New duty cycle percentage
+ */
+void IpmiFan::changeSpeed(int newSpeed) {
+  string cmd = cmdSpeed;
+  size_t pos = cmd.find("{fan}");
+  char   hex[8];
+
+  if (!manModeStat || newSpeed == speed) return;
+
+  if (pos != string::npos) {
+    if (index < 0 || index > 0xfe) return;
+
+    snprintf(hex, sizeof(hex), "0x%02x", index);
+    cmd.replace(pos, 5, hex);
+  }
+
+  snprintf(hex, sizeof(hex), "0x%02x", max(0, min(newSpeed, 100)));
+  if ((pos = cmd.find("{duty}")) != string::npos) cmd.replace(pos, 6, hex);
+
+  if (session->command(cmd)) setSpeed(newSpeed);
+}
+
+void IpmiFan::takeOver(Fan *from) {
+  IpmiFan *fan = dynamic_cast<IpmiFan *>(from);
+
+  Fan::takeOver(from);
+  if (!fan) return;
+
+  manModeStat      = fan->manModeStat;
+  fan->manModeStat = false;
+}
+
+/**
+ * Plugin Fan class constructor.
+ *
+ * @class  PluginFan : public Fan
+ * @public PluginFan::PluginFan
+ *
+ * @param  {string} id     : Fan id on the plugin
+ * @param  {string} path   : Plugin file path
+ * @param  {string} cLabel : Custom label
+ */
+PluginFan::PluginFan(string id, string path, string cLabel)
+    : Fan(loadPlugin(path)->getName(), 0, 0, id, cLabel, plugin),
+      host(loadPlugin(path)), id(id), handle(host->openDevice(id)),
+      manModeStat(false) {
+  fc_device device;
+
+  if (handle < 0 || !host->findDevice(id, device) || device.kind != FC_FAN)
+    throw runtime_error("Plugin fan not found: " + id);
+
+  minS = device.min_speed;
+  maxS = device.max_speed;
+  if (device.label[0]) label = device.label;
+  if (cLabel == "") setCLabel(label + " " + devName);
+}
+
+PluginFan::~PluginFan() { manualModeOff(); }
+
+string PluginFan::getPath() const { return host->getPath(); }
+string PluginFan::getName() const { return id; }
+
+void PluginFan::manualModeOn() {
+  if (!manModeStat) manModeStat = host->manual(handle, true);
+}
+
+void PluginFan::manualModeOff() {
+  if (manModeStat) manModeStat = !host->manual(handle, false);
+}
+
+int PluginFan::readSpeed() {
+  int value;
+  return host->read(handle, value) ? value : 0;
+}
+
+void PluginFan::changeSpeed(int newSpeed) {
+  if (!manModeStat || newSpeed == speed) return;
+
+  if (host->write(handle, max(minS, min(newSpeed, maxS)))) setSpeed(newSpeed);
+}
+
+void PluginFan::takeOver(Fan *from) {
+  PluginFan *fan = dynamic_cast<PluginFan *>(from);
+
+  Fan::takeOver(from);
+  if (!fan) return;
+
+  manModeStat      = fan->manModeStat;
+  fan->manModeStat = false;
+}
+
+FanNode::FanNode(Fan *fan, sensors_vp *sens) : fan(fan), sensors(sens) {}
+FanNode::~FanNode() {}
+
+Fan *       FanNode::getFan() const { return fan; }
+sensors_vp *FanNode::getSensors() const { return sensors; }
+
+void FanNode::setFan(Fan *_fan) { fan = _fan; }
+void FanNode::setSensors(sensors_vp *_sensors, bool clearBefore) {
+  if (clearBefore) clearSensors();
+  delete sensors;
+  sensors = _sensors;
+}
+
+void FanNode::pushBackSensor(Sensor *sensor) { sensors->push_back(sensor); }
+void FanNode::popBackSensor() { sensors->pop_back(); }
+
+/**
+ * Generic fan node class function. Deletes all sensors
+ *
+ * @class  FanNode
+ * @public FanNode::clearSensors
+ */
+void FanNode::clearSensors() {
+  int senSize = sensors->size();
+
+  if (senSize > 0)
+    for (int i = 0; i < senSize; i++) {
+      delete (*sensors)[i];
+      (*sensors)[i] = nullptr;
+    }
+
+  sensors->clear();
+}
+
+/**
+ * Generic fan node class function.
+ *
+ * @class  FanNode
+ * @public FanNode::getMaxPercentage
+ *
+ * @param  {int}  ambT : Ambient temperature
+ * @param  {bool} read : Reads the sensors, false to use the last values
+ * @return {int}       : Maximum percentage range from all sensors
+ */
+int FanNode::getMaxPercentage(int ambT, bool read) {
+  int senSize = sensors->size();
+  int maxPerc = 0;
+
+  if (senSize > 0)
+    for (int i = 0; i < senSize; i++) {
+      Sensor *sensor = (*sensors)[i];
+
+      // Sleeping disks cool down on their own, unless their data is too old
+      if (sensor->isIdle() && !sensor->isStale()) continue;
+
+      maxPerc = max(sensor->update(ambT, read), maxPerc);
+    }
+
+  return maxPerc;
+}
+
+/**
+ * Generic fan node class function. Calculates the fan speed needed
+ *
+ * @class  FanNode
+ * @public FanNode::getTargetSpeed
+ *
+ * @param  {int}  ambT : Ambient temperature
+ * @param  {bool} read : Reads the sensors, false to use the last values
+ * @return {int}       : Fan speed
+ */
+int FanNode::getTargetSpeed(int ambT, bool read) {
+  int minS = fan->getMinS();
+  int maxS = fan->getMaxS();
+  int maxP = getMaxPercentage(ambT, read);
+
+  return minS + ((maxS - minS) * maxP / 100);
+}
+
+/**
+ * Generic fan node class function. Updates the fan speed
+ *
+ * @class  FanNode
+ * @public FanNode::update
+ *
+ * @param  {int}  ambT : Ambient temperature
+ * @param  {bool} read : Reads the sensors, false to use the last values
+ */
+void FanNode::update(int ambT, bool read) {
+  int speed = getTargetSpeed(ambT, read);
+
+  if (speed != fan->getSpeed()) fan->changeSpeed(speed);
+}
+
+SensorSampler::SensorSampler(int interval)
+    : interval(interval), working(false), pending(false), worker(nullptr) {}
+SensorSampler::~SensorSampler() { stop(); }
+
+int  SensorSampler::getInterval() const { return interval; }
+void SensorSampler::setInterval(int _interval) {
+  lock_guard<mutex> lock(mtx);
+  interval = _interval;
+}
+int  SensorSampler::size() const { return sensors.size(); }
+
+/**
+ * Slow sensors sampler class function.
+ * Adds the sensor if it's a slow one, other sensors are ignored.
+ *
+ * @class  SensorSampler
+ * @public SensorSampler::addSensor
+ *
+ * @param  {Sensor*} sensor : Sensor to sample
+ */
+void SensorSampler::addSensor(Sensor *sensor) {
+  SampledSensor *sampled = dynamic_cast<SampledSensor *>(sensor);
+
+  if (sampled && !working) sensors.push_back(sampled);
+}
+
+/**
+ * Slow sensors sampler class function.
+ * Replaces the sampled sensors while the sampler works, the new ones are
+ * sampled right away. Once it returns the old sensors aren't sampled any
+ * more, it waits for a sample in progress.
+ *
+ * @class  SensorSampler
+ * @public SensorSampler::setSensors
+ *
+ * @param  {sampledSens_vp} _sensors : New sampled sensors
+ */
+void SensorSampler::setSensors(const sampledSens_vp &_sensors) {
+  {
+    lock_guard<mutex> lock(sensorsMtx);
+
+    sensors = _sensors;
+    for (unsigned int i = 0; i < sensors.size(); i++)
+      sensors[i]->setAsync(worker != nullptr);
+  }
+
+  if (!worker) {
+    start();
+    return;
+  }
+
+  {
+    lock_guard<mutex> lock(mtx);
+    pending = true;
+  }
+  stopCv.notify_all();
+}
+
+void SensorSampler::clear() {
+  stop();
+  sensors.clear();
+}
+
+/**
+ * Slow sensors sampler class function.
+ * Starts the sampler thread, sensors are switched to async readings.
+ *
+ * @class  SensorSampler
+ * @public SensorSampler::start
+ */
+void SensorSampler::start() {
+  if (working || sensors.empty()) return;
+
+  for (unsigned int i = 0; i < sensors.size(); i++) sensors[i]->setAsync(true);
+
+  working = true;
+  worker  = new thread(threadLoop, this);
+}
+
+/**
+ * Slow sensors sampler class function.
+ * Stops the sampler thread, sensors are switched back to direct readings.
+ *
+ * @class  SensorSampler
+ * @public SensorSampler::stop
+ */
+void SensorSampler::stop() {
+  if (!worker) return;
+
+  {
+    lock_guard<mutex> lock(mtx);
+    working = false;
+  }
+  stopCv.notify_all();
+
+  worker->join();
+  delete worker;
+  worker = nullptr;
+
+  for (unsigned int i = 0; i < sensors.size(); i++) sensors[i]->setAsync(false);
+}
+
+/**
+ * Slow sensors sampler class static function. Thread worker loop.
+ *
+ * @class   SensorSampler
+ * @private SensorSampler::threadLoop
+ *
+ * @param  {SensorSampler*} _this : Pointer SensorSampler
+ */
+void SensorSampler::threadLoop(SensorSampler *_this) {
+  unique_lock<mutex> lock(_this->mtx);
+
+  while (_this->working) {
+    _this->pending = false;
+
+    lock.unlock();
+    _this->sampleAll();
+    lock.lock();
+
+    _this->stopCv.wait_for(
+        lock, chrono::milliseconds(_this->interval),
+        [_this] { return !_this->working || _this->pending; });
+  }
+}
+
+// Samples every sensor, the sensors can't be replaced while one is sampled
+void SensorSampler::sampleAll() {
+  for (unsigned int i = 0; working; i++) {
+    lock_guard<mutex> lock(sensorsMtx);
+
+    if (i >= sensors.size()) break;
+    sensors[i]->sample();
+  }
+}
+
+FanController::FanController(fanNode_vp *fans, Sensor *ambSensor)
+    : ambSensor(nullptr), fans(!fans ? new fanNode_vp : fans), working(false),
+      worker(nullptr), staleLimit(STALE_LIMIT), registry(nullptr),
+      readyFd(-1), statePath("") {}
+FanController::FanController(Sensor *ambSensor, fanNode_vp *fans)
+    : ambSensor(ambSensor), fans(!fans ? new fanNode_vp : fans), working(false),
+      worker(nullptr), staleLimit(STALE_LIMIT), registry(nullptr),
+      readyFd(-1), statePath("") {}
+FanController::FanController(FanController *fanCtl)
+    : ambSensor(fanCtl->getAmbSensor()), fans(fanCtl->getFans()),
+      working(false), worker(nullptr),
+      sampler(fanCtl->getSampleInterval()),
+      staleLimit(fanCtl->getStaleLimit()), registry(nullptr),
+      readyFd(-1), statePath("") {}
+
+/**
+ * Fans controller class destructor.
+ *
+ * @class FanController
+ * @public FanController::~FanController
+ */
+FanController::~FanController() {
+  if (worker || working) {
+    stopWorker();
+    delete worker;
+    worker = nullptr;
+  }
+}
+
+/**
+ * Fans controller class static function. Thread worker loop.
+ *
+ * @class   FanController
+ * @private FanController::threadLoop
+ *
+ * @param  {FanController*} _this : Pointer FanController
+ */
+void FanController::threadLoop(FanController *_this) {
+  IoBatch            batch;   // Reused on every tick
+  vector<char>       buffers; // Reused on every tick
+  int                ticks = 0;
+  unique_lock<mutex> lock(_this->workMtx);
+
+  while (_this && _this->working && _this->fans->size() > 0) {
+    _this->registry->poll(); // Hotplug events queued since the last tick
+    if (_this->tick(batch, buffers)) _this->notifyReady();
+    if (++ticks % STATE_TICKS == 0) _this->saveState();
+
+    // Stops right away, not on the next tick. Unlocked only while waiting,
+    // reloads take the lock to swap the fans between two ticks
+    _this->workCond.wait_for(lock, chrono::seconds(1),
+                             [_this]() { return !_this->working; });
+  }
+}
+
+// Reads a sensor, it is missing while it can't be readed
+static void readSafe(Sensor *sensor) {
+  try {
+    sensor->readTemp();
+    sensor->setMissing(false);
+  } catch (const exception &e) {
+    sensor->setMissing(true);
+  }
+}
+
+/**
+ * Fans controller class function. Control loop iteration.
+ * All sysfs sensors are readed on one batch and then all fan speeds changes
+ * are written on a second batch. Other devices are accessed one by one.
+ * Unreadable sensors are missing until they are readed again, their fans go
+ * to a safe speed meanwhile.
+ *
+ * @class   FanController
+ * @private FanController::tick
+ *
+ * @param  {IoBatch&}      batch   : Batch used for the I/O
+ * @param  {vector<char>&} buffers : I/O buffers storage
+ *
+ * @return {bool}                  : True if all the speeds were written
+ */
+bool FanController::tick(IoBatch &batch, vector<char> &buffers) {
+  const int  bufSize  = 32;
+  int        fansSize = fans->size();
+  sensors_vp batched;
+
+  batch.clear();
+  buffers.clear();
+
+  for (int i = -1; i < fansSize; i++) {
+    sensors_vp *sensors = i < 0 ? nullptr : (*fans)[i]->getSensors();
+    int         senSize = i < 0 ? (ambSensor ? 1 : 0) : sensors->size();
+
+    for (int j = 0; j < senSize; j++) {
+      Sensor *sensor = i < 0 ? ambSensor : (*sensors)[j];
+
+      SysfsFile *file;
+
+      if (sensor->pollIdle()) continue; // Keeps the last temperature
+      if ((file = sensor->getInputFile()) && file->getFd() >= 0)
+        batched.push_back(sensor);
+      else
+        readSafe(sensor);
+    }
+  }
+
+  int batchedSize = batched.size();
+  buffers.resize(max(batchedSize, fansSize) * bufSize);
+
+  for (int i = 0; i < batchedSize; i++)
+    batch.addRead(batched[i]->getInputFile(), &buffers[i * bufSize], bufSize);
+
+  batch.submit();
+
+  for (int i = 0; i < batchedSize; i++) {
+    int value;
+
+    if (SysfsFile::parseInt(&buffers[i * bufSize], batch.result(i), value)) {
+      batched[i]->setTemp(value);
+      batched[i]->setMissing(false);
+    } else
+      readSafe(batched[i]); // Retried one by one
+  }
+
+  int           ambT = !ambSensor ? 0 : ambSensor->getTemp();
+  vector<Fan *> written;
+  vector<int>   speeds, outputs;
+
+  batch.clear();
+
+  for (int i = 0; i < fansSize; i++) {
+    Fan *      fan   = (*fans)[i]->getFan();
+    int        speed = (*fans)[i]->getTargetSpeed(ambT, false);
+    SysfsFile *file  = fan->getOutputFile();
+
+    if (speed == fan->getSpeed()) continue;
+
+    if (file) {
+      char *buf  = &buffers[i * bufSize];
+      int   value = fan->toOutput(speed);
+      int   size  = SysfsFile::formatInt(buf, value);
+
+      batch.addWrite(file, buf, size);
+      written.push_back(fan);
+      speeds.push_back(speed);
+      outputs.push_back(value);
+    } else
+      fan->changeSpeed(speed);
+  }
+
+  batch.submit();
+
+  bool done = true;
+
+  for (int i = 0; i < batch.size(); i++)
+    if (batch.result(i) >= 0) written[i]->setOutput(speeds[i], outputs[i]);
+    else
+      done = false;
+
+  return done;
+}
+
+/**
+ * Fans controller class function. Tells the process waiting for the worker
+ * that fans are under control, only once.
+ *
+ * @class   FanController
+ * @private FanController::notifyReady
+ */
+void FanController::notifyReady() {
+  const char msg[] = "ready\n";
+
+  if (readyFd < 0) return;
+
+  while (write(readyFd, msg, sizeof(msg) - 1) < 0 && errno == EINTR)
+    ;
+  close(readyFd);
+  readyFd = -1;
+}
+
+Sensor *    FanController::getAmbSensor() const { return ambSensor; }
+fanNode_vp *FanController::getFans() const { return fans; }
+
+thread *FanController::getWorker() { return worker; }
+int     FanController::getStaleLimit() const { return staleLimit; }
+int     FanController::getSampleInterval() const {
+  return sampler.getInterval();
+}
+
+void FanController::setAmbSensor(Sensor *_ambSensor, bool delBefore) {
+  if (delBefore && ambSensor) delete ambSensor;
+  ambSensor = _ambSensor;
+}
+void FanController::setFans(fanNode_vp *_fans, bool delBefore) {
+  if (delBefore && fans) delete fans;
+  fans = _fans;
+}
+
+void FanController::setSampleInterval(int interval) {
+  sampler.setInterval(interval);
+}
+void FanController::setStaleLimit(int _staleLimit) { staleLimit = _staleLimit; }
+void FanController::setReadyFd(int fd) { readyFd = fd; }
+void FanController::setStatePath(string path) { statePath = path; }
+
+// Controller state key of a sensor or a fan, its type, path and name
+static string stateKey(int type, string path, string name) {
+  return to_string(type) + " " + path + name;
+}
+
+// A speed the controller could have set, unbound fans have -1
+static bool validSpeed(Fan *fan, int speed) {
+  return speed >= fan->getMinS() && speed <= fan->getMaxS();
+}
+
+static void saveSensorState(ostringstream &state, Sensor *sensor) {
+  if (!sensor || sensor->isMissing()) return;
+
+  state << "sensor " << sensor->getTemp() << " "
+        << stateKey(sensor->type, sensor->getPath(), sensor->getName()) << endl;
+}
+
+/**
+ * Fans controller class function. The fans last speeds and the sensors last
+ * temperatures, so a new fanControl process goes on from them. Lines are
+ * "fan <speed> <key>" and "sensor <temperature> <key>" after the save time.
+ * Handed over fans get a "control <control> <key>" line too, the control
+ * state to take them over.
+ *
+ * @class   FanController
+ * @private FanController::stateText
+ *
+ * @param  {bool} handOver : Fans are handed over to another process
+ *
+ * @return {string}        : Controller state
+ */
+string FanController::stateText(bool handOver) {
+  ostringstream state;
+
+  state << time(nullptr) << endl;
+
+  for (unsigned int i = 0; i < fans->size(); i++) {
+    Fan *       fan     = (*fans)[i]->getFan();
+    sensors_vp *sensors = (*fans)[i]->getSensors();
+    string      key     = stateKey(fan->type, fan->getPath(), fan->getName());
+    string      control = fan->getControl();
+
+    if (validSpeed(fan, fan->getSpeed()))
+      state << "fan " << fan->getSpeed() << " " << key << endl;
+    if (handOver && control != "")
+      state << "control " << control << " " << key << endl;
+
+    for (unsigned int j = 0; j < sensors->size(); j++)
+      saveSensorState(state, (*sensors)[j]);
+  }
+  saveSensorState(state, ambSensor);
+
+  return state.str();
+}
+
+/**
+ * Fans controller class function. Saves the controller state to the state
+ * file, replaced atomically with utils::replaceFile.
+ *
+ * @class   FanController
+ * @private FanController::saveState
+ *
+ * @return {bool} : True if saved, or if the state isn't persisted
+ */
+bool FanController::saveState() {
+  return statePath == "" || replaceFile(statePath, stateText(), 0660);
+}
+
+/**
+ * Reads a controller state if it's fresh, the one handed over by another
+ * process or else the state file.
+ *
+ * @param  {string}               handed : Handed over state, "" if none
+ * @param  {string}               path   : State file path
+ * @param  {map<string, string>&} values : Values by "<kind> <key>"
+ *
+ * @return {long long}                   : State age in seconds, -1 if there
+ *                                         is no state or it's too old
+ */
+static long long readState(string handed, string path,
+                           map<string, string> &values) {
+  istringstream handedState(handed);
+  ifstream      stateFile;
+  istream *     state = &handedState;
+  string        line;
+  long long     savedAt, age;
+
+  if (handed == "") {
+    if (path == "") return -1;
+
+    stateFile.open(path);
+    state = &stateFile;
+  }
+
+  if (!getline(*state, line)) return -1;
+
+  savedAt = atoll(line.c_str());
+  age     = time(nullptr) - savedAt;
+
+  if (savedAt <= 0 || age < 0 || age > FanController::STATE_MAX_AGE)
+    return -1;
+
+  while (getline(*state, line)) {
+    istringstream fields(line);
+    string        kind, value, key;
+
+    if ((fields >> kind >> value) && getline(fields >> ws, key))
+      values[kind + " " + key] = value;
+  }
+
+  return age;
+}
+
+// Gives a sensor its saved temperature, sampled ones keep the sample age
+static void resumeSensor(Sensor *sensor, map<string, string> &values,
+                         int age) {
+  map<string, string>::iterator it;
+
+  if (!sensor) return;
+
+  it = values.find("sensor " + stateKey(sensor->type, sensor->getPath(),
+                                        sensor->getName()));
+  if (it == values.end()) return;
+
+  SampledSensor *sampled = dynamic_cast<SampledSensor *>(sensor);
+
+  if (sampled) sampled->resume(atoi(it->second.c_str()), age * 1000);
+  else
+    sensor->setTemp(atoi(it->second.c_str()));
+}
+
+/**
+ * Fans controller class function. Goes on from the state of the last
+ * fanControl process if it's fresh, the handed over one or else the saved
+ * one: fans get their last speeds back right after manual mode is taken,
+ * and sensors their last temperatures until they are readed, so the first
+ * tick doesn't move the fans.
+ *
+ * @class   FanController
+ * @private FanController::resumeState
+ *
+ * @param  {string} handed : State handed over by another process, "" if none
+ */
+void FanController::resumeState(string handed) {
+  map<string, string> values;
+  long long           age = readState(handed, statePath, values);
+
+  if (age < 0) return;
+
+  for (unsigned int i = 0; i < fans->size(); i++) {
+    Fan *       fan     = (*fans)[i]->getFan();
+    sensors_vp *sensors = (*fans)[i]->getSensors();
+    string      key     = stateKey(fan->type, fan->getPath(), fan->getName());
+
+    int speed = values.count("fan " + key)
+                    ? atoi(values["fan " + key].c_str())
+                    : -1;
+
+    if (validSpeed(fan, speed)) fan->changeSpeed(speed);
+
+    for (unsigned int j = 0; j < sensors->size(); j++)
+      resumeSensor((*sensors)[j], values, age);
+  }
+  resumeSensor(ambSensor, values, age);
+}
+
+/**
+ * Fans controller class function. Takes the control of the fans handed over
+ * by another fanControl process, they are already on manual mode and keep
+ * the control state it handed over with them.
+ *
+ * @class   FanController
+ * @private FanController::resumeControl
+ *
+ * @param  {string} handed : State handed over by another process
+ */
+void FanController::resumeControl(string handed) {
+  map<string, string> values;
+
+  if (readState(handed, "", values) < 0) return;
 
-  if (!shell.exec(CAT(path + "name"))) {
-    path += "device/";
-    if (!shell.exec(CAT(path + "name")))
-      throw runtime_error("Cannot find hwmon device on '" + path + "'");
+  for (unsigned int i = 0; i < fans->size(); i++) {
+    Fan *  fan = (*fans)[i]->getFan();
+    string key = stateKey(fan->type, fan->getPath(), fan->getName());
+
+    if (values.count("control " + key))
+      fan->setControl(values["control " + key]);
+  }
+}
+
+void FanController::pushBackFanNode(FanNode *node) { fans->push_back(node); }
+void FanController::popBackFanNode() { fans->pop_back(); }
+
+// All the sensors, the ambient one first if there is one
+sensors_vp FanController::allSensors() const {
+  sensors_vp sensors;
+
+  if (ambSensor) sensors.push_back(ambSensor);
+
+  for (unsigned int i = 0; i < fans->size(); i++) {
+    sensors_vp *fanSensors = (*fans)[i]->getSensors();
+    sensors.insert(sensors.end(), fanSensors->begin(), fanSensors->end());
+  }
+
+  return sensors;
+}
+
+// Slow sensors of a sensors list, they get the stale limit
+static sampledSens_vp sampledSensors(sensors_vp &sensors, int staleLimit) {
+  sampledSens_vp sampled;
+
+  for (unsigned int i = 0; i < sensors.size(); i++) {
+    SampledSensor *sensor = dynamic_cast<SampledSensor *>(sensors[i]);
+
+    if (!sensor) continue;
+
+    sensor->setStaleLimit(staleLimit);
+    sampled.push_back(sensor);
+  }
+
+  return sampled;
+}
+
+// Registry following the devices of the fans and sensors
+static DeviceRegistry *trackDevices(fanNode_vp *fans, sensors_vp &sensors) {
+  DeviceRegistry *registry = new DeviceRegistry();
+
+  for (unsigned int i = 0; i < sensors.size(); i++)
+    registry->track(sensors[i]);
+  for (unsigned int i = 0; i < fans->size(); i++)
+    registry->track((*fans)[i]->getFan());
+
+  return registry;
+}
+
+/**
+ * Fans controller class function.
+ * Starts the worker wich controlls fans speeds.
+ *
+ * @class  FanController
+ * @public FanController::startWorker
+ *
+ * @param  {string} handed : State of the fans handed over by another
+ *                           process, see handOver(). "" if they aren't
+ */
+void FanController::startWorker(string handed) {
+  int fansSize = fans->size();
+
+  if (!working && fansSize > 0 && !worker) {
+    if (handed != "") resumeControl(handed); // Before manual mode is taken
+
+    for (unsigned int i = 0; i < fansSize; i++)
+      fans->at(i)->getFan()->manualModeOn();
+
+    resumeState(handed);
+
+    // Slow sensors are moved to the sampler thread
+    sensors_vp sensors = allSensors();
+
+    sampler.clear();
+    sampler.setSensors(sampledSensors(sensors, staleLimit));
+
+    // Hotplug devices followed while the worker runs
+    registry = trackDevices(fans, sensors);
+
+    working = true;
+    worker  = new thread(threadLoop, this);
+  }
+}
+
+/**
+ * Fans controller class function.
+ * Stops the worker wich controlls fans speeds.
+ *
+ * @class  FanController
+ * @public FanController::stopWorker
+ */
+void FanController::stopWorker() {
+  if (working || worker) {
+    stopThreads();
+    saveState(); // Before the firmware takes the fans back
+
+    int fansSize = fans->size();
+    for (int i = 0; i < fansSize; i++) fans->at(i)->getFan()->manualModeOff();
+  }
+}
+
+/**
+ * Fans controller class function. Stops the worker to hand the fans over to
+ * another fanControl process, they stay on manual mode at their speeds. The
+ * state to take them over is returned rather than saved, so it reaches the
+ * other process even if the state file can't be written. If the handover
+ * fails the worker can be started again, the fans are still on manual mode.
+ *
+ * @class  FanController
+ * @public FanController::handOver
+ *
+ * @return {string} : State for startWorker(), "" if the worker wasn't running
+ */
+string FanController::handOver() {
+  if (!working && !worker) return "";
+
+  stopThreads();
+  saveState(); // A fresh state file in case the other process dies
+
+  return stateText(true);
+}
+
+/**
+ * Fans controller class function. Gives the fans back to the firmware when
+ * the service can't start, wherever startWorker() failed. Handed over fans
+ * are taken with their control state first, so PWM fans get their own
+ * control mode and duty cycle back, the others are still on manual mode.
+ *
+ * @class  FanController
+ * @public FanController::giveBack
+ *
+ * @param  {string} handed : State of the fans handed over by another
+ *                           process, "" if they aren't
+ */
+void FanController::giveBack(string handed) {
+  stopThreads();
+
+  if (handed != "") resumeControl(handed);
+
+  for (unsigned int i = 0; i < fans->size(); i++) {
+    Fan *fan = (*fans)[i]->getFan();
+
+    if (handed != "") fan->manualModeOn();
+    fan->manualModeOff();
+  }
+}
+
+// Stops the worker, the sampler and the hotplug devices registry
+void FanController::stopThreads() {
+  {
+    lock_guard<mutex> lock(workMtx);
+    working = false;
+  }
+  workCond.notify_all();
+
+  if (worker) {
+    worker->join();
+    delete worker;
+    worker = nullptr;
+  }
+
+  sampler.stop();
+
+  delete registry;
+  registry = nullptr;
+}
+
+// The same fan on another config, nullptr if it isn't there
+static Fan *sameFan(Fan *fan, fanNode_vp *fans) {
+  string key = stateKey(fan->type, fan->getPath(), fan->getName());
+
+  for (unsigned int i = 0; i < fans->size(); i++) {
+    Fan *other = (*fans)[i]->getFan();
+
+    if (stateKey(other->type, other->getPath(), other->getName()) == key)
+      return other;
+  }
+
+  return nullptr;
+}
+
+// Gives a sensor the last temperature of the same sensor on another config
+static void carrySensor(Sensor *sensor, sensors_vp &sensors) {
+  string key = stateKey(sensor->type, sensor->getPath(), sensor->getName());
+
+  for (unsigned int i = 0; i < sensors.size(); i++) {
+    Sensor *from = sensors[i];
+
+    if (from->isMissing() ||
+        stateKey(from->type, from->getPath(), from->getName()) != key)
+      continue;
+
+    SampledSensor *sampled     = dynamic_cast<SampledSensor *>(sensor);
+    SampledSensor *fromSampled = dynamic_cast<SampledSensor *>(from);
+
+    if (!sampled) sensor->setTemp(from->getTemp());
+    else if (fromSampled && fromSampled->getSampleAge() >= 0)
+      sampled->resume(from->getTemp(), fromSampled->getSampleAge());
+
+    return;
+  }
+}
+
+/**
+ * Fans controller class function. Takes the fans and sensors of a controller
+ * built from a changed config, without stopping the worker. Fans on both
+ * configs take the control from the current objects, so they stay on manual
+ * mode, and sensors on both keep their last temperatures. New devices are
+ * set up before and everything is swapped between two ticks.
+ *
+ * The other controller gets the old fans and sensors to be deleted, fans
+ * removed from the config go back to the firmware then.
+ *
+ * @class  FanController
+ * @public FanController::reload
+ *
+ * @param  {FanController*} next : Controller built from the changed config
+ */
+void FanController::reload(FanController *next) {
+  sensors_vp      sensors = next->allSensors(), current = allSensors();
+  sampledSens_vp  sampled = sampledSensors(sensors, next->staleLimit);
+  fanNode_vp *    nextFans     = next->fans;
+  fans_vp         from(nextFans->size(), nullptr);
+  DeviceRegistry *nextRegistry = nullptr;
+
+  { // Paths change on hotplug events, compared between ticks
+    lock_guard<mutex> lock(workMtx);
+
+    for (unsigned int i = 0; i < nextFans->size(); i++)
+      from[i] = sameFan((*nextFans)[i]->getFan(), fans);
+  }
+
+  // New fans are controlled from the first tick, the others already are
+  for (unsigned int i = 0; i < nextFans->size(); i++)
+    if (!from[i]) (*nextFans)[i]->getFan()->manualModeOn();
+
+  for (unsigned int i = 0; i < sampled.size(); i++) sampled[i]->setAsync(true);
+
+  if (working) nextRegistry = trackDevices(nextFans, sensors);
+
+  {
+    lock_guard<mutex> lock(workMtx);
+
+    for (unsigned int i = 0; i < sensors.size(); i++)
+      carrySensor(sensors[i], current);
+
+    for (unsigned int i = 0; i < nextFans->size(); i++)
+      if (from[i]) (*nextFans)[i]->getFan()->takeOver(from[i]);
+
+    swap(fans, next->fans);
+    swap(ambSensor, next->ambSensor);
+    swap(registry, nextRegistry);
+    staleLimit = next->staleLimit;
+  }
+
+  // Old sensors aren't sampled any more once the sampler has the new ones
+  sampler.setInterval(next->getSampleInterval());
+  if (working) sampler.setSensors(sampled);
+
+  delete nextRegistry;
+}
+
+void FanController::clearFans() {
+  for (int i = 0; i < fans->size(); i++) {
+    (*fans)[i]->clearSensors();
+    delete (*fans)[i]->getFan();
+    (*fans)[i]->setFan(nullptr);
+    delete (*fans)[i];
+    (*fans)[i] = nullptr;
+  }
+  fans->clear();
+}
+
+void FanController::clearAll() {
+  if (fans) clearFans();
+  if (ambSensor) delete ambSensor;
+  ambSensor = nullptr;
+}
+
+/**
+ * Disk device struct constructor. Reads the disk info from sysfs.
+ *
+ * @struct Disks
+ * @public Disks::Disks
+ *
+ * @param  {string} disk : Disk name. Example: sda | sdb | nvme0n1...
+ */
+Disks::Disks(string disk)
+    : disk(disk), device("/dev/" + disk), removable(false), size(0) {
+  string path  = BLOCK_CLASS_DIR + disk;
+  int    dirFd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+  if (dirFd < 0) throw runtime_error("Can't read disk info");
+
+  model     = trim(readFileAt(dirFd, "device/model", true));
+  vendor    = trim(readFileAt(dirFd, "device/vendor", true));
+  serial    = trim(readFileAt(dirFd, "device/serial", true));
+  removable = readFileAt(dirFd, "removable", true) == "1";
+  size      = atoll(readFileAt(dirFd, "size", true).c_str());
+
+  // SCSI/SATA disks only have the serial on the unit serial number VPD page
+  if (serial == "") {
+    string vpd = readFileAt(dirFd, "device/vpd_pg80", true);
+    if (vpd.size() > 4) serial = trim(vpd.substr(4));
+  }
+
+  // drivetemp: device/hwmon/hwmonN, nvme: device/hwmonN (class parent)
+  vector<string> hwmonDirs = listDir(path + "/device/hwmon", "hwmon");
+
+  if (!hwmonDirs.empty())
+    hwmon = path + "/device/hwmon/" + hwmonDirs[0] + "/";
+  else if (!(hwmonDirs = listDir(path + "/device", "hwmon")).empty())
+    hwmon = path + "/device/" + hwmonDirs[0] + "/";
+
+  if (hwmon != "" && faccessat(dirFd, (hwmon + "temp1_input").c_str(), F_OK,
+                               0) < 0)
+    hwmon = "";
+
+  close(dirFd);
+}
+
+Disks::~Disks() {}
+
+/**
+ * Disk device struct static function.
+ * Lists real disks, /sys/block has no partitions and virtual devices (loop,
+ * ram, zram, dm...) have no device link. Empty devices are skipped.
+ *
+ * @struct Disks
+ * @public Disks::list
+ *
+ * @return {vector<string>} : Disks names
+ */
+vector<string> Disks::list() {
+  vector<string> entries = listDir(BLOCK_CLASS_DIR);
+  vector<string> disks;
+  int dirFd = open(BLOCK_CLASS_DIR.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+  if (dirFd < 0) return disks;
+
+  for (unsigned int i = 0; i < entries.size(); i++) {
+    string name = entries[i];
+
+    if (faccessat(dirFd, (name + "/device").c_str(), F_OK, 0) < 0 ||
+        atoll(readFileAt(dirFd, name + "/size", true).c_str()) == 0)
+      continue;
+
+    disks.push_back(name);
   }
 
-  name = shell.firsLine();
+  close(dirFd);
+
+  return disks;
+}
+
+/**
+ * Disk device struct static function.
+ *
+ * @struct Disks
+ * @public Disks::readModel
+ *
+ * @param  {string} disk : Disk name
+ *
+ * @return {string}      : Disk model or "" if unknown
+ */
+string Disks::readModel(string disk) {
+  return trim(readFile(BLOCK_CLASS_DIR + disk + "/device/model", true));
+}
+
+/**
+ * Disk device struct static function. Checks the runtime PM status of a disk
+ * (device/power/runtime_status), reading it never wakes the disk.
+ *
+ * @struct Disks
+ * @public Disks::isSuspended
+ *
+ * @param  {SysfsFile&} power : Disk runtime_status file
+ *
+ * @return {bool}             : True if the disk is suspended
+ */
+bool Disks::isSuspended(SysfsFile &power) {
+  char    buf[16];
+  ssize_t len = power.read(buf, sizeof(buf));
+
+  return len >= 9 && strncmp(buf, "suspended", 9) == 0;
+}
+
+/**
+ * hwmon device struct constructor.
+ * Scans the device directory in process, using device/ when the hwmon
+ * directory itself has no name file.
+ *
+ * @struct HwmonDevice
+ * @public HwmonDevice::HwmonDevice
+ *
+ * @param  {string} path : hwmon device driver path
+ */
+HwmonDevice::HwmonDevice(string path) : path(checkDir(path)) {
+  int dirFd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+  if (dirFd >= 0 && (name = readFileAt(dirFd, "name", true)) == "") {
+    int devFd = openat(dirFd, "device", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    close(dirFd);
+    dirFd = devFd;
+    path += "device/";
 
-  if (shell.exec(LS(path + "fan*_input") " | sed 's,_input,,g'")) {
-    shell.getLine(lineComm);
+    if (dirFd >= 0) name = readFileAt(dirFd, "name", true);
+  }
 
-    int    startPos = lineComm.find_last_of('/') + 1;
-    string fanPath  = lineComm.substr(0, startPos);
+  if (dirFd < 0 || name == "") {
+    if (dirFd >= 0) close(dirFd);
+    throw runtime_error("Cannot find hwmon device on '" + path + "'");
+  }
 
-    do {
-      string    fanName = lineComm.substr(startPos);
-      HwMonFan *fan     = new HwMonFan(name, fanPath, fanName);
-      fans.push_back(fan);
-    } while (shell.getLine(lineComm));
+  vector<string> fanFiles    = listDirAt(dirFd, "fan", "_input");
+  vector<string> sensorFiles = listDirAt(dirFd, "temp", "_input");
+  vector<int>    fanTypes;
+
+  // applesmc layout (fanN_manual) or pwmN, fans without control are skipped
+  for (unsigned int i = 0; i < fanFiles.size(); i++) {
+    string fanName = fanFiles[i].substr(0, fanFiles[i].size() - 6);
+    string pwmName = "pwm" + fanName.substr(3);
+
+    if (faccessat(dirFd, (fanName + "_manual").c_str(), F_OK, 0) == 0)
+      fanTypes.push_back(Fan::hwmon);
+    else if (faccessat(dirFd, (pwmName + "_enable").c_str(), F_OK, 0) == 0)
+      fanTypes.push_back(Fan::pwm);
+    else
+      fanTypes.push_back(Fan::abstract);
   }
 
-  if (shell.exec(LS(path + "temp*_input") " | sed 's,_input,,g'")) {
-    shell.getLine(lineComm);
+  close(dirFd);
+
+  for (unsigned int i = 0; i < fanFiles.size(); i++) {
+    string fanName = fanFiles[i].substr(0, fanFiles[i].size() - 6);
+
+    if (fanTypes[i] == Fan::hwmon)
+      fans.push_back(new HwMonFan(name, path, fanName));
+    else if (fanTypes[i] == Fan::pwm)
+      fans.push_back(new PwmFan(name, path, fanName));
+  }
 
-    int    startPos   = lineComm.find_last_of('/') + 1;
-    string sensorPath = lineComm.substr(0, startPos - 1);
+  for (unsigned int i = 0; i < sensorFiles.size(); i++) {
+    string sensorName = sensorFiles[i].substr(0, sensorFiles[i].size() - 6);
+    HwMonSensor *sensor = new HwMonSensor(name, path, sensorName);
 
-    do {
-      string       sensorName = lineComm.substr(startPos);
-      HwMonSensor *sensor     = new HwMonSensor(name, sensorPath, sensorName);
+    // Constructors don't read, unreadable inputs are left out here
+    try {
+      sensor->readTemp();
       sensors.push_back(sensor);
-    } while (shell.getLine(lineComm));
+    } catch (const exception &e) {
+      delete sensor;
+    }
   }
 }
 
@@ -524,46 +2445,221 @@ HwmonDevice::~HwmonDevice() {
 }
 
 /**
- * System devices struct constructor.
+ * Runs the jobs 0..count-1 on up to SystemDevices::MAX_WORKERS threads, the
+ * calling one included. Workers take the next job from a shared counter, so
+ * jobs storing their result by index keep the serial order. The first job
+ * exception, by index, is rethrown once all of them are done.
+ *
+ * @param  {unsigned int}                  count : Number of jobs
+ * @param  {function<void(unsigned int)>&} job   : Job, called with its index
+ */
+static void parallelFor(unsigned int count,
+                        const function<void(unsigned int)> &job) {
+  atomic<unsigned int>  next(0);
+  vector<exception_ptr> errors(count);
+  vector<thread>        workers;
+  unsigned int          nWorkers =
+      count < SystemDevices::MAX_WORKERS ? count : SystemDevices::MAX_WORKERS;
+
+  function<void()> work = [&]() {
+    for (unsigned int i = next++; i < count; i = next++) {
+      try {
+        job(i);
+      } catch (...) {
+        errors[i] = current_exception();
+      }
+    }
+  };
+
+  for (unsigned int i = 1; i < nWorkers; i++)
+    workers.push_back(thread(work));
+  work();
+  for (unsigned int i = 0; i < workers.size(); i++)
+    workers[i].join();
+
+  for (unsigned int i = 0; i < count; i++)
+    if (errors[i]) rethrow_exception(errors[i]);
+}
+
+/**
+ * System devices struct constructor. Thermal zones, disks, hwmon devices
+ * and helpers are discovered in parallel, each one does blocking reads or
+ * runs a command, and they are listed on the same order as serially.
  *
  * @struct SystemDevices
  * @public SystemDevices::~SystemDevices
  */
-SystemDevices::SystemDevices() : nFans(0), nSensors(0) {
-  ShellCommand shell;
+SystemDevices::SystemDevices(string helpersDir, string pluginsDir)
+    : nFans(0), nSensors(0) {
+  vector<string> diskNames = Disks::list();
+  vector<string> hwmonDirs = listDir(HWMON_CLASS_DIR, "hwmon");
+  vector<string> zoneDirs  = listDir(THERMAL_CLASS_DIR, "thermal_zone");
+  vector<string> diskHwmons; // disks hwmon devices real paths
+  char           realPath[PATH_MAX];
+
+  vector<string> helperFiles =
+      helpersDir == "" ? vector<string>() : listDir(helpersDir);
+  vector<string> pluginFiles =
+      pluginsDir == "" ? vector<string>() : listDir(pluginsDir, "", ".so");
+
+  if (hwmonDirs.empty() && zoneDirs.empty() && helperFiles.empty() &&
+      pluginFiles.empty() && !IpmiSession::available())
+    throw runtime_error("hwmon devices not found");
+
+  // Zones without a readable temperature (disabled, broken firmware) are
+  // left out
+  vector<ThermalZoneSensor *> zones(zoneDirs.size(), nullptr);
+
+  parallelFor(zoneDirs.size(), [&](unsigned int i) {
+    ThermalZoneSensor *zone = nullptr;
+
+    try {
+      zone =
+          new ThermalZoneSensor(THERMAL_CLASS_DIR + zoneDirs[i], zoneDirs[i]);
+      zone->readTemp();
+      zones[i] = zone;
+    } catch (const exception &e) {
+      delete zone;
+    }
+  });
+
+  for (unsigned int i = 0; i < zones.size(); i++)
+    if (zones[i]) zoneSensors.push_back(zones[i]);
+
+  disks.resize(diskNames.size(), nullptr);
+  parallelFor(diskNames.size(),
+              [&](unsigned int i) { disks[i] = new Disks(diskNames[i]); });
+
+  for (unsigned int i = 0; i < disks.size(); i++)
+    if (disks[i]->hwmon != "" && realpath(disks[i]->hwmon.c_str(), realPath))
+      diskHwmons.push_back(realPath);
+
+  // Disks hwmon devices are listed as disks sensors, not as hwmon devices,
+  // they aren't scanned so their disks aren't woken up
+  vector<string> hwmonPaths;
+
+  for (unsigned int i = 0; i < hwmonDirs.size(); i++) {
+    string path = HWMON_CLASS_DIR + hwmonDirs[i];
+
+    if (realpath(path.c_str(), realPath) &&
+        find(diskHwmons.begin(), diskHwmons.end(), string(realPath)) !=
+            diskHwmons.end())
+      continue;
+
+    hwmonPaths.push_back(path);
+  }
+
+  hwmonDevices.resize(hwmonPaths.size(), nullptr);
+  parallelFor(hwmonPaths.size(), [&](unsigned int i) {
+    hwmonDevices[i] = new HwmonDevice(hwmonPaths[i]);
+  });
+
+  for (unsigned int i = 0; i < hwmonDevices.size(); i++) {
+    nFans += hwmonDevices[i]->fans.size();
+    nSensors += hwmonDevices[i]->sensors.size();
+  }
+
+  int useDaemon = -1; // hddtemp daemon only probed when a disk needs it
+
+  for (unsigned int i = 0; i < disks.size(); i++) {
+    Disks * disk   = disks[i];
+    Sensor *sensor = nullptr;
+
+    if (disk->hwmon != "") {
+      sensor = new DriveTempSensor(
+          disk->disk, disk->hwmon, 45, 63, 27, disk->model, disk->model);
+      diskSensors.push_back(sensor);
+      continue;
+    }
+
+    if (useDaemon < 0) useDaemon = HddTempDaemon::get()->isOnline();
+
+    if (useDaemon)
+      sensor = new HddTempDSensor(
+          disk->disk, 45, 63, 27, disk->model, HDDTEMPD_ADDR);
+    else if (hddtempBin() != "")
+      sensor = new HddTempSensor(
+          disk->disk, 45, 63, 27, disk->model, hddtempBin());
+
+    if (sensor) diskSensors.push_back(sensor);
+  }
+
+  nHwmonDevs   = hwmonDevices.size();
+  nDisks       = disks.size();
+  nDiskSensors = diskSensors.size();
+  nZoneSensors = zoneSensors.size();
+
+  // Local BMC, one ipmitool shell for the discovery and the readings
+  if (IpmiSession::available()) {
+    IpmiSession *  session = IpmiSession::get();
+    vector<string> temps   = session->listSdr("Temperature");
+    vector<string> fans    = session->listSdr("Fan");
+
+    for (unsigned int i = 0; i < temps.size(); i++)
+      ipmiSensors.push_back(new IpmiSensor(temps[i]));
+    for (unsigned int i = 0; i < fans.size(); i++)
+      ipmiFans.push_back(new IpmiFan(fans[i]));
+  }
+
+  nIpmiSensors = ipmiSensors.size();
+  nIpmiFans    = ipmiFans.size();
+  nFans += nIpmiFans;
 
-  if (!shell.exec(HWMON_DEVS)) throw runtime_error("hwmon devices not found");
+  // External helpers, every executable on the helpers directory
+  vector<map<string, string>> helperIds(helperFiles.size());
+
+  checkDir(helpersDir);
+  parallelFor(helperFiles.size(), [&](unsigned int i) {
+    string command = helpersDir + helperFiles[i];
+
+    if (access(command.c_str(), X_OK) != 0) return;
+
+    // Untrusted helpers are left out
+    try {
+      helperIds[i] = ExecHelper::get(command)->list();
+    } catch (const exception &e) {
+    }
+  });
 
-  string hwmonPath;
-  while (shell.getLine(hwmonPath)) {
-    HwmonDevice *hwmonDev = new HwmonDevice(hwmonPath);
-    hwmonDevices.push_back(hwmonDev);
+  for (unsigned int i = 0; i < helperFiles.size(); i++) {
+    map<string, string> &ids = helperIds[i];
 
-    nFans += hwmonDev->fans.size();
-    nSensors += hwmonDev->sensors.size();
+    for (map<string, string>::iterator it = ids.begin(); it != ids.end(); ++it)
+      execSensors.push_back(new ExecSensor(
+          it->first, helpersDir + helperFiles[i], 45, 78, 24, "", it->second));
   }
 
-  if (shell.exec(HDDTEMP_PATH)) {
-    string hddtempPath = shell.firsLine();
+  nExecSensors = execSensors.size();
 
-    if (!shell.exec(DISKS)) throw runtime_error("Error reading disks devices");
+  // Backend plugins, every shared object on the plugins directory
+  for (unsigned int i = 0; i < pluginFiles.size(); i++) {
+    string            path = checkDir(pluginsDir) + pluginFiles[i];
+    PluginHost *      host = PluginHost::get(path);
+    vector<fc_device> devices;
 
-    string disk;
-    while (shell.getLine(disk)) {
-      Disks *        hddDev  = new Disks(disk);
-      HddTempSensor *hddtemp = new HddTempSensor(
-          hddDev->disk, 45, 63, 27, hddDev->model, hddtempPath);
-      disks.push_back(hddDev);
-      hddtempSensors.push_back(hddtemp);
+    if (host) devices = host->getDevices();
+
+    for (unsigned int j = 0; j < devices.size(); j++) {
+      try {
+        if (devices[j].kind == FC_FAN)
+          pluginFans.push_back(new PluginFan(devices[j].id, path));
+        else if (devices[j].kind == FC_SENSOR)
+          pluginSensors.push_back(new PluginSensor(devices[j].id, path));
+      } catch (const exception &e) {
+      }
     }
   }
 
-  nHwmonDevs = hwmonDevices.size();
-  nDisks     = disks.size();
+  nPluginSensors = pluginSensors.size();
+  nPluginFans    = pluginFans.size();
+  nFans += nPluginFans;
 }
 
 SystemDevices::~SystemDevices() {
-  int maxSize = max(nHwmonDevs, nDisks);
+  int maxSize = max(max(nHwmonDevs, nDisks), max(nZoneSensors, nIpmiFans));
+
+  maxSize = max(maxSize, int(max(nIpmiSensors, nExecSensors)));
+  maxSize = max(maxSize, int(max(nPluginSensors, nPluginFans)));
 
   for (int i = 0; i < maxSize; i++) {
     if (i < nHwmonDevs) {
@@ -573,13 +2669,52 @@ SystemDevices::~SystemDevices() {
 
     if (i < nDisks) {
       delete disks[i];
-      delete hddtempSensors[i];
-      disks[i]          = nullptr;
-      hddtempSensors[i] = nullptr;
+      disks[i] = nullptr;
+    }
+
+    if (i < nDiskSensors) {
+      delete diskSensors[i];
+      diskSensors[i] = nullptr;
+    }
+
+    if (i < nZoneSensors) {
+      delete zoneSensors[i];
+      zoneSensors[i] = nullptr;
+    }
+
+    if (i < nIpmiSensors) {
+      delete ipmiSensors[i];
+      ipmiSensors[i] = nullptr;
+    }
+
+    if (i < nIpmiFans) {
+      delete ipmiFans[i];
+      ipmiFans[i] = nullptr;
+    }
+
+    if (i < nExecSensors) {
+      delete execSensors[i];
+      execSensors[i] = nullptr;
+    }
+
+    if (i < nPluginSensors) {
+      delete pluginSensors[i];
+      pluginSensors[i] = nullptr;
+    }
+
+    if (i < nPluginFans) {
+      delete pluginFans[i];
+      pluginFans[i] = nullptr;
     }
   }
 
   hwmonDevices.clear();
-  hddtempSensors.clear();
+  diskSensors.clear();
+  zoneSensors.clear();
+  ipmiSensors.clear();
+  ipmiFans.clear();
+  execSensors.clear();
+  pluginSensors.clear();
+  pluginFans.clear();
   disks.clear();
 }
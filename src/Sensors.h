@@ -13,16 +13,28 @@
 #ifndef SENSORS_H_
 #define SENSORS_H_
 
+#include <atomic>
+#include <condition_variable>
 #include <iostream>
+#include <mutex>
 #include <thread>
 #include <vector>
 
+#include "ExecHelper.h"
+#include "HddTempDaemon.h"
+#include "IpmiSession.h"
+#include "PluginHost.h"
+#include "io_batch.h"
 #include "utils.h"
 
 using namespace std;
 using namespace utils;
 
-extern const string HDDTEMP_BIN;
+extern const string HWMON_CLASS_DIR;
+extern const string BLOCK_CLASS_DIR;
+extern const string THERMAL_CLASS_DIR;
+
+string hddtempBin(); // hddtemp binary path, "" if not installed
 
 /**
  * Sensors abstract class.
@@ -41,15 +53,26 @@ protected:
   mutable string cLabel;   // Custom sensor label
   string         devName;  // Device name
   string         name;     // Disk name or file name depending on the type;
+  bool           missing;  // Unreadable on the last tick, safe speed
 
-  int tempPercentage(int = 0);
+  int tempPercentage(int = 0, bool = true);
 
 public:
   Sensor(string, string, string, string, int = 0, int = 0, int = 0, string = "",
          int = abstract);
-  ~Sensor();
-
-  enum sensorTypes { abstract, hwmon, hddtemp };
+  virtual ~Sensor();
+
+  enum sensorTypes {
+    abstract,
+    hwmon,
+    hddtemp,
+    hddtempd,
+    drivetemp,
+    thermal,
+    ipmi,
+    exec,
+    plugin
+  };
   int type;
 
   string getLabel() const;
@@ -74,9 +97,17 @@ public:
   void setName(string);
   void setDevName(string);
 
-  int update(int = 0);
+  bool isMissing() const;
+  void setMissing(bool);
+
+  int update(int = 0, bool = true);
 
-  virtual int readTemp() = 0;
+  virtual int        readTemp() = 0;
+  virtual SysfsFile *getInputFile(); // Input file for batched reads or null
+  virtual bool       isStale() const; // Last reading too old to trust
+  virtual bool       isIdle() const;  // Device sleeping, temp is the last one
+  virtual bool       pollIdle();      // Refreshes and returns the idle state
+  virtual bool       rebind(string);  // Moves to a new device path, "" unbinds
 };
 
 typedef vector<Sensor>   sensors_v;
@@ -98,9 +129,9 @@ protected:
 
 public:
   Fan(string, int, int, string, string = "", int = abstract);
-  ~Fan();
+  virtual ~Fan();
 
-  enum fanTypes { abstract, hwmon };
+  enum fanTypes { abstract, hwmon, pwm, ipmi, plugin };
   int type;
 
   int    getMinS() const;
@@ -123,6 +154,19 @@ public:
   virtual void   changeSpeed(int) = 0; // Changes fan speed
   virtual string getPath() const  = 0; // Gets device path
   virtual string getName() const  = 0; // Gets fan file path
+
+  virtual SysfsFile *getOutputFile();     // Batched writes output file or null
+  virtual int        toOutput(int) const; // Output file value for a speed
+  virtual void       setOutput(int, int); // Output value written for a speed
+
+  virtual bool   isCalibrated() const;    // Fan ready to be controlled
+  virtual bool   calibrate();             // Calibrates the fan, can take long
+  virtual string getCalibration() const;  // Calibration to store on config
+  virtual bool   setCalibration(string);  // Restores a stored calibration
+  virtual bool   rebind(string);          // Moves to a new device path
+  virtual void   takeOver(Fan *);         // Takes the control from another
+  virtual string getControl() const;      // Control state to hand it over
+  virtual bool   setControl(string);      // Takes it over from a process
 };
 
 /**
@@ -132,7 +176,7 @@ public:
  */
 class HwMonSensor : public Sensor {
 private:
-  string pInput; // Input sensor file path
+  SysfsFile fInput; // Input sensor file
 
 public:
   HwMonSensor(string, string, string, int = 45, int = 78, int = 24, string = "",
@@ -141,31 +185,239 @@ public:
 
   string getInputPath() const;
 
-  int readTemp();
+  int        readTemp();
+  SysfsFile *getInputFile();
+  bool       rebind(string);
 };
 
 typedef vector<HwMonSensor>   hwmSens_v;
 typedef vector<HwMonSensor *> hwmSens_vp;
 
+/**
+ * Disk hwmon Sensor class. Disk temperature from the drivetemp or nvme hwmon
+ * drivers, readed like any other hwmon sensor.
+ *
+ * @class DriveTempSensor : public HwMonSensor
+ */
+class DriveTempSensor : public HwMonSensor {
+private:
+  SysfsFile fPower; // Disk runtime power status file
+  bool      idle;   // Disk suspended on the last poll
+
+public:
+  DriveTempSensor(string, string, int = 45, int = 63, int = 27, string = "",
+                  string = "");
+  ~DriveTempSensor();
+
+  int        readTemp();
+  SysfsFile *getInputFile();
+  bool       isIdle() const;
+  bool       pollIdle();
+};
+
+/**
+ * Thermal zone Sensor class. Kernel thermal framework zones
+ * (/sys/class/thermal/thermal_zoneN), used by ACPI and SoCs temperatures that
+ * aren't exposed through hwmon.
+ *
+ * @class ThermalZoneSensor : public Sensor
+ */
+class ThermalZoneSensor : public Sensor {
+private:
+  SysfsFile fInput; // Zone temp file
+
+public:
+  ThermalZoneSensor(string, string, int = 45, int = 78, int = 24,
+                    string = "", string = "");
+  ~ThermalZoneSensor();
+
+  int        readTemp();
+  SysfsFile *getInputFile();
+};
+
+/**
+ * IPMI Sensor class. BMC temperature sensor data record, readed through the
+ * shared IpmiSession so all the IPMI sensors of a tick are one exchange.
+ * Keeps the last temperature on failed readings until it gets stale.
+ *
+ * @class IpmiSensor : public Sensor
+ */
+class IpmiSensor : public Sensor {
+private:
+  IpmiSession *session; // Shared BMC session
+  long long    readAt;  // Last reading time, steady clock milliseconds
+
+public:
+  static const int STALE_LIMIT = 10000; // Milliseconds without readings
+
+  IpmiSensor(string, int = 45, int = 78, int = 24, string = "", string = "");
+  ~IpmiSensor();
+
+  int  readTemp();
+  bool isStale() const;
+};
+
+/**
+ * External Sensor class. Temperature from a helper program that stays
+ * running, see ExecHelper for the protocol. Keeps the last temperature on
+ * failed readings until it gets stale.
+ *
+ * @class ExecSensor : public Sensor
+ */
+class ExecSensor : public Sensor {
+private:
+  ExecHelper *helper; // Shared helper
+  long long   readAt; // Last reading time, steady clock milliseconds
+
+public:
+  static const int STALE_LIMIT = 10000; // Milliseconds without readings
+
+  ExecSensor(string, string, int = 45, int = 78, int = 24, string = "",
+             string = "");
+  ~ExecSensor();
+
+  int  readTemp();
+  bool isStale() const;
+};
+
+/**
+ * Plugin Sensor class. Temperature from a backend plugin, all the sensors of
+ * a plugin are readed with one batched call. Keeps the last temperature on
+ * failed readings until it gets stale.
+ *
+ * @class PluginSensor : public Sensor
+ */
+class PluginSensor : public Sensor {
+private:
+  PluginHost *host;   // Loaded plugin
+  int         handle; // Device handle on the plugin
+  long long   readAt; // Last reading time, steady clock milliseconds
+
+public:
+  static const int STALE_LIMIT = 10000; // Milliseconds without readings
+
+  PluginSensor(string, string, int = 45, int = 78, int = 24, string = "",
+               string = "");
+  ~PluginSensor();
+
+  int  readTemp();
+  bool isStale() const;
+};
+
+/**
+ * Slow sensors abstract class, like disks ones.
+ * When a SensorSampler owns the sensor the readings are done on the sampler
+ * thread and readTemp() only returns the last published value.
+ *
+ * @class SampledSensor : public Sensor
+ */
+class SampledSensor : public Sensor {
+protected:
+  atomic<int>       sampled;    // Last sampled temperature
+  atomic<long long> sampledAt;  // Last sample time, steady clock milliseconds
+  atomic<bool>      async;      // Sampled by a SensorSampler
+  atomic<bool>      idle;       // Device sleeping on the last sample
+  int               staleLimit; // Maximum sample age in milliseconds, 0 = off
+
+  virtual bool sampleTemp(int &) = 0; // Reads the device, can block seconds
+
+public:
+  SampledSensor(string, string, string, string, int = 0, int = 0, int = 0,
+                string = "", int = abstract);
+  ~SampledSensor();
+
+  void setAsync(bool);
+  void setStaleLimit(int);
+
+  int  sample();
+  int  readTemp();
+  void resume(int, int);
+  int  getSampleAge() const;
+  bool isStale() const;
+  bool isIdle() const;
+  bool pollIdle();
+};
+
+typedef vector<SampledSensor *> sampledSens_vp;
+
 /**
  * hddtemp Sensor class.
  *
- * @class HddTempSensor : public Sensor
+ * @class HddTempSensor : public SampledSensor
  */
-class HddTempSensor : public Sensor {
+class HddTempSensor : public SampledSensor {
 private:
-  string cInput; // Input sensor command
+  string    cInput; // Input sensor command
+  SysfsFile fPower; // Disk runtime power status file
+
+  bool sampleTemp(int &);
 
 public:
-  HddTempSensor(string, int = 45, int = 63, int = 27, string = "", string = "");
+  HddTempSensor(string, int = 45, int = 63, int = 27, string = "", string = "",
+                string = "");
   ~HddTempSensor();
-
-  int readTemp();
 };
 
 typedef vector<HddTempSensor>   hddtSens_v;
 typedef vector<HddTempSensor *> hddtSens_vp;
 
+/**
+ * hddtemp daemon Sensor class. Reads the disk from a running `hddtemp -d`.
+ *
+ * @class HddTempDSensor : public SampledSensor
+ */
+class HddTempDSensor : public SampledSensor {
+private:
+  HddTempDaemon *daemon; // Shared daemon client
+  string         device; // Disk device path
+
+  bool sampleTemp(int &);
+
+public:
+  HddTempDSensor(string, int = 45, int = 63, int = 27, string = "",
+                 string = "", string = "");
+  ~HddTempDSensor();
+};
+
+/**
+ * Slow sensors sampler class. Reads its sensors on a background thread at
+ * its own cadence so the control loop never waits on them.
+ *
+ * @class SensorSampler
+ */
+class SensorSampler {
+private:
+  sampledSens_vp     sensors;    // Sampled sensors
+  int                interval;   // Milliseconds between samples
+  atomic<bool>       working;    // Sampler is working control
+  bool               pending;    // New sensors waiting for a sample
+  thread *           worker;     // Sampler thread
+  mutex              mtx;        // Stop wait lock
+  mutex              sensorsMtx; // Sensors changes lock, held while sampling
+  condition_variable stopCv;     // Wakes the sampler to stop
+
+  static void threadLoop(SensorSampler *);
+
+  void sampleAll();
+
+public:
+  static const int INTERVAL = 5000; // Default milliseconds between samples
+
+  SensorSampler(int = INTERVAL);
+  ~SensorSampler();
+
+  int  getInterval() const;
+  void setInterval(int);
+
+  void addSensor(Sensor *);
+  void setSensors(const sampledSens_vp &);
+  void clear();
+  int  size() const;
+
+  void start();
+  void stop();
+};
+
 /**
  * hwmon Fan class.
  *
@@ -175,15 +427,16 @@ class HwMonFan : public Fan {
 private:
   string       path;        // hwmon path
   string       fileName;    // hwmon fan file name without sufix
-  string       pInput;      // Input speed fan file path
-  string       pOutput;     // Output speed fan file path
-  string       pManual;     // Manual selector fan file path
+  SysfsFile    fInput;      // Input speed fan file
+  SysfsFile    fOutput;     // Output speed fan file
+  SysfsFile    fManual;     // Manual selector fan file
   mutable bool manModeStat; // Manual mode status
 
   void manualMode(bool);
 
 public:
-  HwMonFan(string, string, string, string = "");
+  HwMonFan(string, string, string, string = "", string = "", int = -1,
+           int = -1);
   ~HwMonFan();
 
   string getPath() const;
@@ -195,10 +448,159 @@ public:
   int readSpeed();
 
   void changeSpeed(int);
+
+  SysfsFile *getOutputFile();
+  bool       rebind(string);
+  void       takeOver(Fan *);
 };
 
-typedef vector<HwMonFan>   fans_v;
-typedef vector<HwMonFan *> fans_vp;
+/**
+ * hwmon PWM Fan class. Super-I/O and most hwmon chips layout: duty cycle on
+ * pwmN (0-255), control mode on pwmN_enable and speed on fanN_input.
+ *
+ * Speeds are RPM like on the other fans. A calibration sweep measures the RPM
+ * reached by each duty cycle, the duty cycle where the fan stalls and the one
+ * it needs to start, so a target speed is translated to the exact duty cycle.
+ *
+ * @class PwmFan : public Fan
+ */
+class PwmFan : public Fan {
+private:
+  struct Point {
+    int pwm; // Duty cycle
+    int rpm; // Speed reached
+  };
+
+  string        path;        // hwmon path
+  string        fileName;    // hwmon fan file name without sufix (fanN)
+  SysfsFile     fInput;      // Input speed fan file (fanN_input)
+  SysfsFile     fPwm;        // Duty cycle file (pwmN)
+  SysfsFile     fEnable;     // Control mode file (pwmN_enable)
+  vector<Point> table;       // Calibration table, ascending duty cycles
+  int           stallPwm;    // Lowest duty cycle keeping the fan spinning
+  int           startPwm;    // Lowest duty cycle starting a stopped fan
+  int           lastPwm;     // Last duty cycle written, -1 if unknown
+  int           autoEnable;  // Control mode before manual mode
+  int           autoPwm;     // Duty cycle before manual mode
+  bool          manModeStat; // Manual mode status
+
+  int  measure(int, int);
+  void updateRange();
+
+public:
+  static const int PWM_MAX  = 255;  // Maximum duty cycle
+  static const int CAL_STEP = 15;   // Calibration duty cycle step
+  static const int SETTLE   = 2500; // Milliseconds to settle the fan speed
+
+  PwmFan(string, string, string, string = "", string = "");
+  ~PwmFan();
+
+  string getPath() const;
+  string getName() const;
+
+  void manualModeOn();
+  void manualModeOff();
+
+  int readSpeed();
+  int dutyFor(int) const;
+
+  void changeSpeed(int);
+
+  SysfsFile *getOutputFile();
+  int        toOutput(int) const;
+  void       setOutput(int, int);
+
+  bool   isCalibrated() const;
+  bool   calibrate();
+  string getCalibration() const;
+  bool   setCalibration(string);
+  bool   rebind(string);
+  void   takeOver(Fan *);
+  string getControl() const;
+  bool   setControl(string);
+};
+
+/**
+ * IPMI Fan class. Fans driven through raw BMC commands, which are board
+ * specific, so the commands are templates set on the config. "{duty}" is
+ * replaced with the duty cycle percentage in hex (0x00-0x64) and "{fan}" with
+ * the fan index in hex, the number on its SDR name minus one (Fan1 is 0x00).
+ *
+ * The manual mode is BMC wide, it is only left when the last IPMI fan of the
+ * session leaves it.
+ *
+ * Speeds are duty cycle percentages, readSpeed() gives the fan sensor RPM.
+ *
+ * @class IpmiFan : public Fan
+ */
+class IpmiFan : public Fan {
+private:
+  IpmiSession *session;      // Shared BMC session
+  string       name;         // Fan SDR sensor name
+  string       cmdManualOn;  // Manual mode command
+  string       cmdManualOff; // Automatic mode command
+  string       cmdSpeed;     // Duty cycle command template
+  int          index;        // Fan index on the BMC, -1 if unknown
+  bool         manModeStat;  // Manual mode status
+
+public:
+  static const string MANUAL_ON;     // Default manual mode command
+  static const string MANUAL_OFF;    // Default automatic mode command
+  static const string SET_SPEED;     // Default duty cycle command template
+  static const string SET_SPEED_ALL; // Old default, set all the fans at once
+  static const int    MIN_DUTY = 20; // Minimum duty cycle percentage
+
+  IpmiFan(string, string = "", string = "");
+  ~IpmiFan();
+
+  string getPath() const;
+  string getName() const;
+  string getManualOnCmd() const;
+  string getManualOffCmd() const;
+  string getSpeedCmd() const;
+
+  void setCommands(string, string, string);
+
+  void manualModeOn();
+  void manualModeOff();
+
+  int readSpeed();
+
+  void changeSpeed(int);
+  void takeOver(Fan *);
+};
+
+/**
+ * Plugin Fan class. Fan driven by a backend plugin, speeds are in the plugin
+ * units and the range is the one the plugin discovered.
+ *
+ * @class PluginFan : public Fan
+ */
+class PluginFan : public Fan {
+private:
+  PluginHost *host;        // Loaded plugin
+  string      id;          // Device id on the plugin
+  int         handle;      // Device handle on the plugin
+  bool        manModeStat; // Manual mode status
+
+public:
+  PluginFan(string, string, string = "");
+  ~PluginFan();
+
+  string getPath() const;
+  string getName() const;
+
+  void manualModeOn();
+  void manualModeOff();
+
+  int readSpeed();
+
+  void changeSpeed(int);
+  void takeOver(Fan *);
+};
+
+typedef vector<HwMonFan> fans_v;
+typedef vector<Fan *>    fans_vp;
 
 /**
  * Generic fan node class, it can be any derived from Fan abstract class.
@@ -229,13 +631,16 @@ public:
 
   void clearSensors();
 
-  int  getMaxPercentage(int);
-  void update(int);
+  int  getMaxPercentage(int, bool = true);
+  int  getTargetSpeed(int, bool = true);
+  void update(int, bool = true);
 };
 
 typedef vector<FanNode>   fanNode_v;
 typedef vector<FanNode *> fanNode_vp;
 
+class DeviceRegistry;
+
 /**
  * Fans controller class. It controls fan nodes.
  *
@@ -249,12 +654,33 @@ private:
   Sensor *            ambSensor;
   mutable fanNode_vp *fans;
 
-  mutable bool    working; // Worker is working control
-  mutable thread *worker;  // Worker thread
+  mutable bool       working;  // Worker is working control
+  mutable thread *   worker;   // Worker thread
+  mutex              workMtx;  // working changes lock
+  condition_variable workCond; // Wakes the worker up to stop
+
+  SensorSampler   sampler;    // Slow sensors sampler
+  int             staleLimit; // Slow sensors maximum sample age, milliseconds
+  DeviceRegistry *registry;   // Hotplug devices, while the worker runs
+  int             readyFd;    // Told after the first good tick, -1 if none
+  string          statePath;  // Controller state file, "" if not persisted
 
   static void threadLoop(FanController *);
 
+  bool       tick(IoBatch &, vector<char> &);
+  sensors_vp allSensors() const;
+  void       notifyReady();
+  string     stateText(bool = false);
+  bool       saveState();
+  void       resumeState(string);
+  void       resumeControl(string);
+  void       stopThreads();
+
 public:
+  static const int STALE_LIMIT   = 30000; // Default slow sensors max age ms
+  static const int STATE_TICKS   = 30;    // Ticks between state saves
+  static const int STATE_MAX_AGE = 120;   // Seconds a saved state is resumed
+
   FanController(fanNode_vp * = new fanNode_vp, Sensor * = nullptr);
   FanController(Sensor *, fanNode_vp * = new fanNode_vp);
   FanController(FanController *);
@@ -264,33 +690,50 @@ public:
   fanNode_vp *getFans() const;
 
   thread *getWorker();
+  int     getSampleInterval() const;
+  int     getStaleLimit() const;
 
   void setAmbSensor(Sensor * = nullptr, bool = true);
   void setFans(fanNode_vp * = nullptr, bool = true);
+  void setSampleInterval(int);
+  void setStaleLimit(int);
+  void setReadyFd(int);
+  void setStatePath(string);
 
   void pushBackFanNode(FanNode *);
   void popBackFanNode();
 
-  void startWorker();
-  void stopWorker();
+  void   startWorker(string = "");
+  void   stopWorker();
+  string handOver();
+  void   giveBack(string = "");
+  void reload(FanController *);
 
   void clearFans();
   void clearAll();
 };
 
 /**
- * hddtemp device struct. Contains disk info.
+ * Disk device struct. Contains disk info readed from /sys/block.
  *
  * @struct Disks
  */
 struct Disks {
-  string disk;   // disk name
-  string device; // disk device path
-  string model;  // disk model
-  string serial; // disk serial
+  string    disk;      // disk name
+  string    device;    // disk device path
+  string    model;     // disk model
+  string    serial;    // disk serial
+  string    vendor;    // disk vendor
+  string    hwmon;     // disk hwmon directory (drivetemp/nvme) or ""
+  bool      removable; // removable media
+  long long size;      // disk size in 512 bytes sectors
 
   Disks(string);
   ~Disks();
+
+  static vector<string> list();
+  static string         readModel(string);
+  static bool           isSuspended(SysfsFile &);
 };
 
 typedef vector<Disks>   disks_v;
@@ -322,14 +765,29 @@ typedef vector<HwmonDevice *> hwmonDevs_vp;
 struct SystemDevices {
   disks_vp     disks;          // Disks
   hwmonDevs_vp hwmonDevices;   // hwmon devices
-  hddtSens_vp  hddtempSensors; // hddtemp sensors
+  sensors_vp   diskSensors;    // disks sensors (hwmon or hddtemp)
+  unsigned int nDiskSensors;   // number of disks sensors
+  sensors_vp   zoneSensors;    // thermal zones sensors
+  unsigned int nZoneSensors;   // number of thermal zones sensors
+  sensors_vp   ipmiSensors;    // local BMC sensors
+  unsigned int nIpmiSensors;   // number of local BMC sensors
+  fans_vp      ipmiFans;       // local BMC fans, also counted on nFans
+  unsigned int nIpmiFans;      // number of local BMC fans
+  sensors_vp   execSensors;    // external helpers sensors
+  unsigned int nExecSensors;   // number of external helpers sensors
+  sensors_vp   pluginSensors;  // backend plugins sensors
+  unsigned int nPluginSensors; // number of backend plugins sensors
+  fans_vp      pluginFans;     // backend plugins fans, also counted on nFans
+  unsigned int nPluginFans;    // number of backend plugins fans
 
   unsigned int nFans;      // Number of fans
   unsigned int nSensors;   // Number of sensors
   unsigned int nHwmonDevs; // number of hwmon devices
   unsigned int nDisks;     // number of disks
 
-  SystemDevices();
+  static const unsigned int MAX_WORKERS = 8; // Discovery threads
+
+  SystemDevices(string = "", string = "");
   ~SystemDevices();
 };
 
@@ -24,9 +24,9 @@ using namespace std;
 using namespace utils;
 
 ConfigMode::ConfigMode(string menuTitle)
-    : SYS_DEVS(new SystemDevices()), fanCtlWiz(nullptr), fanCtlCfg(nullptr),
-      menu(Menu(menuTitle)), stage(start_menu), is_new_fan(false),
-      selectedSensor(nullptr), selectedFan(nullptr) {
+    : SYS_DEVS(new SystemDevices(EXEC_DIR, PLUGIN_DIR)), fanCtlWiz(nullptr),
+      fanCtlCfg(nullptr), menu(Menu(menuTitle)), stage(start_menu),
+      is_new_fan(false), selectedSensor(nullptr), selectedFan(nullptr) {
   for (int i = 0; i < SYS_DEVS->nHwmonDevs; i++) {
     HwmonDevice *dev         = SYS_DEVS->hwmonDevices[i];
     hwmSens_vp * sensors     = &dev->sensors;
@@ -45,12 +45,42 @@ ConfigMode::ConfigMode(string menuTitle)
     }
   }
 
-  for (int i = 0; i < SYS_DEVS->nDisks; i++) {
-    HddTempSensor *sensor = SYS_DEVS->hddtempSensors[i];
-    HDDTEMP_S.push_back(sensor);
+  for (int i = 0; i < SYS_DEVS->nDiskSensors; i++) {
+    Sensor *sensor = SYS_DEVS->diskSensors[i];
+    DISK_S.push_back(sensor);
     SENSORS.push_back(sensor);
   }
 
+  for (int i = 0; i < SYS_DEVS->nZoneSensors; i++) {
+    Sensor *sensor = SYS_DEVS->zoneSensors[i];
+    ZONE_S.push_back(sensor);
+    SENSORS.push_back(sensor);
+  }
+
+  for (int i = 0; i < SYS_DEVS->nIpmiSensors; i++) {
+    Sensor *sensor = SYS_DEVS->ipmiSensors[i];
+    IPMI_S.push_back(sensor);
+    SENSORS.push_back(sensor);
+  }
+
+  for (int i = 0; i < SYS_DEVS->nExecSensors; i++) {
+    Sensor *sensor = SYS_DEVS->execSensors[i];
+    EXEC_S.push_back(sensor);
+    SENSORS.push_back(sensor);
+  }
+
+  for (int i = 0; i < SYS_DEVS->nPluginSensors; i++) {
+    Sensor *sensor = SYS_DEVS->pluginSensors[i];
+    PLUGIN_S.push_back(sensor);
+    SENSORS.push_back(sensor);
+  }
+
+  for (int i = 0; i < SYS_DEVS->nIpmiFans; i++)
+    FANS.push_back(SYS_DEVS->ipmiFans[i]);
+
+  for (int i = 0; i < SYS_DEVS->nPluginFans; i++)
+    FANS.push_back(SYS_DEVS->pluginFans[i]);
+
   sysFansSz = FANS.size();
   sysSensSz = SENSORS.size();
 }
@@ -85,12 +115,20 @@ ConfigMode::~ConfigMode() {
   int maxSize = max(sysSensSz, int(SYS_DEVS->nFans));
   for (int i = 0; i < maxSize; i++) {
     if (i < hwmonSize) HWMON_S[i] = nullptr;
-    if (i < SYS_DEVS->nDisks) HDDTEMP_S[i] = nullptr;
+    if (i < SYS_DEVS->nDiskSensors) DISK_S[i] = nullptr;
+    if (i < SYS_DEVS->nZoneSensors) ZONE_S[i] = nullptr;
+    if (i < SYS_DEVS->nIpmiSensors) IPMI_S[i] = nullptr;
+    if (i < SYS_DEVS->nExecSensors) EXEC_S[i] = nullptr;
+    if (i < SYS_DEVS->nPluginSensors) PLUGIN_S[i] = nullptr;
     if (i < SYS_DEVS->nFans) FANS[i] = nullptr;
     if (i < sysSensSz) SENSORS[i] = nullptr;
   }
   HWMON_S.clear();
-  HDDTEMP_S.clear();
+  DISK_S.clear();
+  ZONE_S.clear();
+  IPMI_S.clear();
+  EXEC_S.clear();
+  PLUGIN_S.clear();
   FANS.clear();
   SENSORS.clear();
 
@@ -431,7 +469,9 @@ void ConfigMode::buildSensorOpts() {
     for (int i = 0; i < sysSensSz; i++) {
       Sensor *sensor = SENSORS[i];
 
-      if (type == Sensor::abstract || type == sensor->type) {
+      // Thermal zones and BMC sensors can also be used as ambient sensors
+      if (type == Sensor::abstract || type == sensor->type ||
+          sensor->type == Sensor::thermal || sensor->type == Sensor::ipmi) {
         bool selected = false;
         int  sensInd  = -1;
 
@@ -538,8 +578,12 @@ void ConfigMode::start() {
       case confirm_add_fan:
         if (confirm("Do you want to add " +
                     labels_str(selectedFan->getFan()))) {
-          fanCtlWiz->pushBackFanNode(selectedFan);
-          is_new_fan = false;
+          if (calibrateFan(selectedFan->getFan())) {
+            fanCtlWiz->pushBackFanNode(selectedFan);
+            is_new_fan = false;
+          } else
+            cout << "Cannot calibrate " << labels_str(selectedFan->getFan())
+                 << endl;
         }
 
         stage = fanCtlWiz->getFans()->size() < sysFansSz
@@ -596,6 +640,7 @@ void ConfigMode::start() {
       case del_config_menu:
         if (confirm("Are you sure you want to delete the current config?")) {
           ShComm shell;
+          shell.exec(RM(PLAN_FILE));
           if (shell.exec(RM(CFG_FILE))) cout << "Config deleted succesfully";
           else
             cout << "Error: Can't delete current config";
@@ -27,7 +27,11 @@ using namespace utils;
 class ConfigMode {
   SystemDevices *const SYS_DEVS;  // Devices
   hwmSens_vp           HWMON_S;   // Helper pointers to system devices
-  hddtSens_vp          HDDTEMP_S; // Helper pointers to system devices
+  sensors_vp           DISK_S;    // Helper pointers to system devices
+  sensors_vp           ZONE_S;    // Helper pointers to system devices
+  sensors_vp           IPMI_S;    // Helper pointers to system devices
+  sensors_vp           EXEC_S;    // Helper pointers to system devices
+  sensors_vp           PLUGIN_S;  // Helper pointers to system devices
   fans_vp              FANS;      // Helper pointers to system devices
   sensors_vp           SENSORS;   // Helper pointers to system devices
 
@@ -0,0 +1,77 @@
+/*
+ *  fanControl backend plugins C ABI.
+ *  Plugins are shared objects on the plugins directory exporting
+ *  fancontrol_plugin(). Only this header is needed to build one.
+ *
+ *  File: fan_plugin.h
+ *  Author: b4fThrive
+ *  Copyright (c) 2020 b4f.thrive@gmail.com
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#ifndef FAN_PLUGIN_H_
+#define FAN_PLUGIN_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* ABI version, plugins built for another version are not loaded */
+#define FC_PLUGIN_ABI 1
+
+#define FC_ID_SIZE 64 /* Device id and label size, with the ending '\0' */
+
+/* Device kinds */
+#define FC_SENSOR 0 /* Temperature sensor, values in millidegrees Celsius */
+#define FC_FAN    1 /* Fan, values are speeds in the plugin units */
+
+/* Discovered device */
+typedef struct fc_device {
+  int  kind;              /* FC_SENSOR or FC_FAN */
+  char id[FC_ID_SIZE];    /* Unique on the plugin, stored on the config */
+  char label[FC_ID_SIZE]; /* Label shown on the config wizard */
+  int  min_speed;         /* Fans minimum speed */
+  int  max_speed;         /* Fans maximum speed */
+} fc_device;
+
+/*
+ * Plugin functions table. All the functions are called from the control
+ * loop thread, except discover() and open_device() that can be called from
+ * the config wizard too. Batched functions get arrays of count elements and
+ * set status[i] to 0 or a negative errno for each device.
+ */
+typedef struct fc_plugin {
+  unsigned int abi;  /* FC_PLUGIN_ABI */
+  const char * name; /* Plugin name */
+
+  /* Opens the plugin, returns its context (can be NULL) */
+  void *(*open)(void);
+  /* Fills up to max devices, returns the number of devices or -errno */
+  int (*discover)(void *ctx, fc_device *devices, int max);
+  /* Opens a device by id, returns a handle >= 0 or -errno */
+  int (*open_device)(void *ctx, const char *id);
+  /* Reads sensors temperatures or fans speeds */
+  int (*read)(void *ctx, const int *handles, int count, int *values,
+              int *status);
+  /* Sets fans speeds */
+  int (*write)(void *ctx, const int *handles, int count, const int *values,
+               int *status);
+  /* Takes (on = 1) or gives back (on = 0) a fan control */
+  int (*manual)(void *ctx, int handle, int on);
+  /* Closes the plugin */
+  void (*close)(void *ctx);
+} fc_plugin;
+
+/* Plugin entry point, the only exported symbol fanControl looks for */
+typedef const fc_plugin *(*fc_plugin_entry)(void);
+
+#define FC_PLUGIN_ENTRY "fancontrol_plugin"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FAN_PLUGIN_H_ */
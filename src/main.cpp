@@ -13,15 +13,24 @@
  */
 
 #include "main.h"
+#include <cerrno>
 #include <chrono>
 #include <csignal>
+#include <cstdio>
+#include <fcntl.h>
 #include <fstream>
 #include <iostream>
 #include <map>
+#include <poll.h>
+#include <sys/file.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
 #include <thread>
 #include <unistd.h>
 
+#include "ControlPlan.h"
+#include "DeviceRegistry.h"
 #include "Sensors.h"
 #include "config_menu.h"
 #include "fanControlConfig.h"
@@ -35,15 +44,20 @@ using namespace std;
  * Aplication globals
  ******************************************************************************/
 
-const string APP_USER  = getenv("USER");
-const string HOME_PATH = getenv("HOME");
-const string APP_PATH  = HOME_PATH + "/.fanControl";
-const string CFG_FILE  = APP_PATH + "/config";
-const string LOG_FILE  = APP_PATH + "/log";
-const string CRASH_LOG = APP_PATH + "/crashlog";
-const string VAR_DIR   = "/var/run/fanControl";
-const string PID_FILE  = VAR_DIR + "/pid";
-const string USR_FILE  = VAR_DIR + "/usr";
+const string APP_USER   = getenv("USER");
+const string HOME_PATH  = getenv("HOME");
+const string APP_PATH   = HOME_PATH + "/.fanControl";
+const string CFG_FILE   = APP_PATH + "/config";
+const string PLAN_FILE  = CFG_FILE + ".plan";
+const string STATE_FILE = APP_PATH + "/state";
+const string LOG_FILE   = APP_PATH + "/log";
+const string CRASH_LOG  = APP_PATH + "/crashlog";
+const string EXEC_DIR   = FANCONTROL_HELPER_DIR;
+const string PLUGIN_DIR = FANCONTROL_PLUGIN_DIR;
+const string VAR_DIR    = "/var/run/fanControl";
+const string PID_FILE   = VAR_DIR + "/pid";
+const string USR_FILE   = VAR_DIR + "/usr";
+const string UPG_FIFO   = VAR_DIR + "/upgrade";
 
 FanController *fanController = nullptr; // FanController used for the service
 
@@ -54,6 +68,9 @@ FanController *fanController = nullptr; // FanController used for the service
 map<string, int> commands = {{"start", start},
                              {"stop", stop},
                              {"restart", restart},
+                             {"reload", reload},
+                             {"upgrade", upgrade},
+                             {"takeover", takeover},
                              {"status", status},
                              {"config", config},
                              {"help", help},
@@ -80,13 +97,16 @@ int main(int argc, char const *argv[]) {
   }
 
   switch (command) { // clang-format off
-    case restart: stopApp();
-    case start  : startApp();     break;
-    case stop   : stopApp();      break;
-    case help   : showHelp();     break;
-    case config : configWizard(); break;
-    case status : appStatus();    break;
-    case version: showVers();     break;
+    case restart : stopApp();
+    case start   : startApp();               break;
+    case stop    : stopApp();                break;
+    case reload  : reloadApp();              break;
+    case upgrade : upgradeApp();             break;
+    case takeover: takeOverApp(argc, argv);  break;
+    case help    : showHelp();               break;
+    case config  : configWizard();           break;
+    case status  : appStatus();              break;
+    case version : showVers();               break;
   } // clang-format on
 
   exit(EXIT_SUCCESS);
@@ -96,17 +116,171 @@ int main(int argc, char const *argv[]) {
  * Definitions
  ******************************************************************************/
 
+/**
+ * Gets the running service pid. The service holds a lock on the PID file
+ * while it runs, files left by a crashed one aren't taken as running.
+ *
+ * @return {pid_t} : Service pid, 0 if it isn't running
+ */
+static pid_t runningPid() {
+  int   fd  = open(PID_FILE.c_str(), O_RDONLY | O_CLOEXEC);
+  pid_t pid = 0;
+
+  if (fd < 0) return 0;
+
+  if (flock(fd, LOCK_SH | LOCK_NB) < 0 && errno == EWOULDBLOCK)
+    pid = atoi(readFile(PID_FILE, true).c_str());
+
+  close(fd);
+
+  return pid;
+}
+
+/**
+ * Takes the single instance lock, the PID file locked. It is kept by the
+ * service until it exits.
+ *
+ * @return {int} : Locked PID file descriptor, -1 if it's already locked
+ */
+static int lockPidFile() {
+  int fd = open(PID_FILE.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0660);
+
+  if (fd >= 0 && flock(fd, LOCK_EX | LOCK_NB) < 0) {
+    close(fd);
+    fd = -1;
+  }
+
+  return fd;
+}
+
+/**
+ * Reads a pipe until a whole line or, with untilEof, until it's closed.
+ *
+ * @param  {int}  fd       : Pipe read end
+ * @param  {int}  timeout  : Maximum wait in milliseconds
+ * @param  {bool} untilEof : Read everything the writer sends
+ *
+ * @return {string}        : Data read, "" if the writer exited before
+ *                           sending a line or it timed out
+ */
+static string readPipe(int fd, int timeout, bool untilEof = false) {
+  chrono::steady_clock::time_point deadline =
+      chrono::steady_clock::now() + chrono::milliseconds(timeout);
+  pollfd pfd = {fd, POLLIN, 0};
+  string msg;
+  char   buf[256];
+
+  while (untilEof || msg.find('\n') == string::npos) {
+    int left = chrono::duration_cast<chrono::milliseconds>(
+                   deadline - chrono::steady_clock::now())
+                   .count();
+    int res = left <= 0 ? 0 : poll(&pfd, 1, left);
+
+    if (res < 0 && errno == EINTR) continue;
+    if (res <= 0) return "";
+
+    ssize_t len = read(fd, buf, sizeof(buf));
+
+    if (len < 0 && errno == EINTR) continue;
+    if (len == 0 && untilEof && msg.find('\n') != string::npos) break;
+    if (len <= 0) return "";
+
+    msg.append(buf, len);
+  }
+
+  return msg;
+}
+
+/**
+ * Waits the service readiness message, "ready" once its first control tick
+ * is done or "error <message>".
+ *
+ * @param  {int} fd      : Readiness pipe read end
+ * @param  {int} timeout : Maximum wait in milliseconds
+ *
+ * @return {string}      : Message, "" if the service exited or timed out
+ */
+static string waitReady(int fd, int timeout) {
+  string msg = readPipe(fd, timeout);
+
+  return msg.substr(0, msg.find('\n'));
+}
+
+// Service start failure, told to the starting process through the pipe
+static void startFailed(int readyFd, string eMsg) {
+  string msg = "error " + eMsg + "\n";
+
+  crashLog(eMsg);
+  while (write(readyFd, msg.c_str(), msg.size()) < 0 && errno == EINTR)
+    ;
+  exit(EXIT_FAILURE);
+}
+
+// Fans to calibrate can't be controlled by a running service
+static void checkCalibrated(FanController *fanCtl) {
+  fanNode_vp *fans = fanCtl->getFans();
+
+  if (fans->empty()) throw runtime_error("No fans configured");
+
+  for (unsigned int i = 0; i < fans->size(); i++) {
+    Fan *fan = (*fans)[i]->getFan();
+
+    if (!fan->isCalibrated())
+      throw runtime_error("Fan " + fan->getCLabel() +
+                          " needs a calibration, restart fanControl");
+  }
+}
+
+// Writes the service pid on the locked PID file
+static bool writePid(int lockFd, pid_t pid) {
+  string PID = to_string(pid);
+
+  return ftruncate(lockFd, 0) == 0 &&
+         pwrite(lockFd, PID.c_str(), PID.size(), 0) == (ssize_t)PID.size();
+}
+
+// Signals are waited by the service main thread, the others never get them
+static void blockSignals(sigset_t &signals) {
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGTERM);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGHUP);
+  sigaddset(&signals, SIGUSR2);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+}
+
+/**
+ * Service main thread. SIGHUP reloads the config and SIGUSR2 upgrades the
+ * service, the other signals stop it.
+ *
+ * @param  {int}       lockFd  : Locked PID file descriptor
+ * @param  {sigset_t&} signals : Blocked signals
+ */
+static void serve(int lockFd, sigset_t &signals) {
+  int sig = SIGTERM;
+
+  while (sigwait(&signals, &sig) == 0 && (sig == SIGHUP || sig == SIGUSR2)) {
+    if (sig == SIGHUP) reloadConfig();
+    else
+      upgradeService(lockFd);
+  }
+
+  signHandler(sig);
+}
+
 // Starts fanControl service
 void startApp() {
-  ShComm shell;
+  struct stat st;
+  int         lockFd, ready[2];
 
   umask(007);
 
-  if (!shell.exec(LS_LA(APP_PATH))) mkdir(APP_PATH.c_str(), 0770);
+  if (stat(APP_PATH.c_str(), &st) < 0) mkdir(APP_PATH.c_str(), 0770);
+  if (stat(VAR_DIR.c_str(), &st) < 0) mkdir(VAR_DIR.c_str(), 0770);
 
-  // check if fanControl is already running
-  if (shell.exec(CAT(PID_FILE)) && shell.exec(CAT(USR_FILE))) {
-    string user = shell.firsLine();
+  // check if fanControl is already running, the lock is kept by the service
+  if ((lockFd = lockPidFile()) < 0) {
+    string user = readFile(USR_FILE, true);
     string eMsg = APP_USER == user
                       ? "fanControl is already running"
                       : "The user " + user + " has fanControl already running";
@@ -115,14 +289,50 @@ void startApp() {
     exit(EXIT_FAILURE);
   }
 
-  if (!shell.exec(LS(CFG_FILE))) {
+  if (access(CFG_FILE.c_str(), F_OK) < 0) {
     string eMsg = "Cannot read fanControl config '" + CFG_FILE + "'";
     crashLog(eMsg);
     cout << eMsg << endl;
     exit(EXIT_FAILURE);
   }
 
-  readConfig(fanController);
+  // Configs without the cached labels are written again with them
+  bool cached = false;
+
+  try {
+    cached = readConfig(fanController);
+  } catch (const exception &e) {
+    string eMsg = "Cannot read fanControl config: " + string(e.what());
+    crashLog(eMsg);
+    cout << eMsg << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  // PWM fans calibrated now are stored, so it's done only once
+  fanNode_vp *fans       = fanController->getFans();
+  bool        calibrated = false;
+
+  for (unsigned int i = 0; i < fans->size(); i++) {
+    Fan *fan = (*fans)[i]->getFan();
+
+    if (fan->isCalibrated()) continue;
+    if (!calibrateFan(fan)) {
+      string eMsg = "Cannot calibrate fan " + fan->getCLabel();
+      crashLog(eMsg);
+      cout << eMsg << endl;
+      exit(EXIT_FAILURE);
+    }
+    calibrated = true;
+  }
+
+  if (calibrated || !cached) writeConfig(fanController);
+
+  if (pipe2(ready, O_CLOEXEC) < 0) {
+    string eMsg = "Cannot start fanControl, pipe fails";
+    crashLog(eMsg);
+    cout << eMsg << endl;
+    exit(EXIT_FAILURE);
+  }
 
   pid_t sid, pid = fork();
 
@@ -134,126 +344,289 @@ void startApp() {
     exit(EXIT_FAILURE);
   }
 
-  if (pid > 0) // exits parent process
+  if (pid > 0) // exits parent process when fans are under control
   {
-    int pidNum = 0, i = 0;
+    string PID = to_string(pid);
 
     cout << "Starting fanControl" << endl;
 
-    while (!shell.exec(CAT(PID_FILE)) && ++i < 36) {
-      cout.flush();
-      cout << ".";
-      this_thread::sleep_for(chrono::milliseconds(250));
-    }
+    close(ready[1]);
 
-    string PID = shell.firsLine();
+    string msg = waitReady(ready[0], START_TIMEOUT);
 
-    if (PID == "") {
-      string eMsg = "Cannot start fanControl.";
+    if (msg != "ready") {
+      string eMsg = msg.compare(0, 6, "error ") == 0
+                        ? msg.substr(6)
+                        : "Cannot start fanControl.";
 
+      kill(pid, SIGTERM); // Nothing half started is left running
       crashLog(eMsg);
-      cout << endl << eMsg << endl;
+      cout << eMsg << endl;
 
       exit(EXIT_FAILURE);
     }
 
     appLog("fanControl started with pid " + PID);
-    cout << endl << "fanControl started with pid " + PID << endl;
+    cout << "fanControl started with pid " + PID << endl;
 
     exit(EXIT_SUCCESS);
   }
 
+  close(ready[0]);
+
   sid = setsid();
 
-  if (!shell.exec(LS_LA(VAR_DIR))) mkdir(VAR_DIR.c_str(), 0770);
+  if (!writePid(lockFd, sid))
+    startFailed(ready[1], "Error writting file " + PID_FILE);
+  if (!writeFile(USR_FILE, APP_USER))
+    startFailed(ready[1], "Error writting file " + USR_FILE);
 
-  if (!writeFile(USR_FILE, APP_USER)) {
-    string eMsg = "Error writting file " + USR_FILE;
-    crashLog(eMsg);
-    cout << eMsg << endl;
-    exit(EXIT_FAILURE);
-  }
-  if (!writeFile(PID_FILE, to_string(sid))) {
-    string eMsg = "Error writting file " + PID_FILE;
-    crashLog(eMsg);
-    cout << eMsg << endl;
-    exit(EXIT_FAILURE);
-  }
+  sigset_t signals;
 
-  fanController->startWorker();
+  blockSignals(signals);
+
+  try {
+    fanController->setReadyFd(ready[1]);
+    fanController->setStatePath(STATE_FILE);
+    fanController->startWorker();
+  } catch (const exception &e) {
+    fanController->giveBack(); // Not left on manual mode
+    startFailed(ready[1], e.what());
+  }
 
   closeSTDdescriptors();
 
-  // SIGTERM capture to stop the worker if needed
-  signal(SIGTERM, signHandler);
+  serve(lockFd, signals);
+}
+
+/**
+ * Waits a process exit. Its pidfd is readable once it exits, without it
+ * (kernels older than 5.3) the PID file lock is checked until it's released.
+ *
+ * @param  {pid_t} pid     : Process id
+ * @param  {int}   pidFd   : Process pidfd, -1 if not available
+ * @param  {int}   timeout : Maximum wait in milliseconds
+ *
+ * @return {bool}          : True if the process exited
+ */
+static bool waitExit(pid_t pid, int pidFd, int timeout) {
+  chrono::steady_clock::time_point deadline =
+      chrono::steady_clock::now() + chrono::milliseconds(timeout);
+
+  while (chrono::steady_clock::now() < deadline) {
+    int left = chrono::duration_cast<chrono::milliseconds>(
+                   deadline - chrono::steady_clock::now())
+                   .count();
+
+    if (pidFd >= 0) {
+      pollfd pfd = {pidFd, POLLIN, 0};
+      int    res = poll(&pfd, 1, left);
+
+      if (res < 0 && errno == EINTR) continue;
+      return res > 0;
+    }
 
-  if (fanController && fanController->getWorker())
-    fanController->getWorker()->join();
+    if (runningPid() != pid) return true;
+    this_thread::sleep_for(chrono::milliseconds(min(left, 20)));
+  }
+
+  return false;
 }
 
-// Stops fanControl service
+// Stops fanControl service, it removes its own runtime files
 void stopApp() {
-  ShComm shell;
-  string pidRun = readFile(PID_FILE, true);
+  pid_t  pid    = runningPid();
+  string pidRun = to_string(pid);
+  int    pidFd;
 
   // checks if fanControl is running
-  if (pidRun == "") {
+  if (pid == 0) {
     cout << "fanControl is not running" << endl;
     exit(EXIT_FAILURE);
   }
 
   cout << "Stopping fanControl" << endl;
 
-  if (system(("kill " + pidRun).c_str()) < 0) // kill child process
-  {
+  // Opened before the signal, a reused pid is never waited
+#ifdef SYS_pidfd_open
+  pidFd = syscall(SYS_pidfd_open, pid, 0);
+#else
+  pidFd = -1; // Headers older than Linux 5.3, the lock is polled
+#endif
+
+  if (kill(pid, SIGTERM) < 0) {
     string eMsg = "Cannot stop fanControl with pid=" + pidRun;
     crashLog(eMsg);
-    cout << endl
-         << eMsg << endl
-         << "Try again or manually kill the process." << endl;
+    cout << eMsg << endl << "Try again or manually kill the process." << endl;
     exit(EXIT_FAILURE);
   }
 
-  int  i       = 0;
-  bool running = shell.exec(LS(("/proc/" + pidRun)));
-  while ((running = shell.exec()) && ++i < 36) {
-    cout.flush();
-    cout << ".";
-    this_thread::sleep_for(chrono::milliseconds(250));
-  }
+  bool stopped = waitExit(pid, pidFd, STOP_TIMEOUT);
 
-  if (running) {
+  if (pidFd >= 0) close(pidFd);
+
+  if (!stopped) {
     string eMsg = "Cannot stop fanControl with pid=" + pidRun +
                   ", exceded maximum time to stop it.";
     crashLog(eMsg);
-    cout << endl
-         << eMsg << endl
-         << "Try again or manually kill the process." << endl;
+    cout << eMsg << endl << "Try again or manually kill the process." << endl;
     exit(EXIT_FAILURE);
   }
 
-  if (system("rm /var/run/fanControl/*") < 0) { // remove var files
-    string eMsg = "Cannot delete fanControl /var/run files";
+  cout << "fanControl stopped" << endl;
+}
+
+// Asks the running service to reload its config
+void reloadApp() {
+  pid_t  pid    = runningPid();
+  string pidRun = to_string(pid);
+
+  if (pid == 0) {
+    cout << "fanControl is not running" << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  if (kill(pid, SIGHUP) < 0) {
+    string eMsg = "Cannot reload fanControl with pid=" + pidRun;
     crashLog(eMsg);
-    cout << endl
-         << eMsg << endl
-         << "Please delete the files with the command "
-            "'rm /var/run/fanControl/*' "
-            "if you want start fanControl before reboot "
-            "or shutdown the system."
-         << endl;
+    cout << eMsg << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  cout << "fanControl config reload requested, see " << LOG_FILE << endl;
+}
+
+// Upgrades the running service to the installed binary
+void upgradeApp() {
+  pid_t  pid    = runningPid();
+  string pidRun = to_string(pid);
+  int    fd     = -1;
+
+  if (pid == 0) {
+    cout << "fanControl is not running" << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  cout << "Upgrading fanControl" << endl;
+
+  umask(007);
+  unlink(UPG_FIFO.c_str());
+
+  // The new service tells here when its first control tick is done
+  if (mkfifo(UPG_FIFO.c_str(), 0660) == 0)
+    fd = open(UPG_FIFO.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+
+  if (fd < 0) {
+    string eMsg = "Cannot create " + UPG_FIFO;
+    crashLog(eMsg);
+    cout << eMsg << endl;
+    unlink(UPG_FIFO.c_str());
+    exit(EXIT_FAILURE);
   }
 
-  cout << endl << "fanControl stopped" << endl;
+  string msg = kill(pid, SIGUSR2) < 0 ? "" : waitReady(fd, UPGRADE_TIMEOUT);
+
+  close(fd);
+  unlink(UPG_FIFO.c_str());
+
+  // Errors told by the service are already on its crashlog
+  if (msg.compare(0, 6, "error ") == 0) {
+    cout << msg.substr(6) << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  if (msg != "ready") {
+    string eMsg = "Cannot upgrade fanControl with pid=" + pidRun;
+    crashLog(eMsg);
+    cout << eMsg << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  cout << "fanControl upgraded, running with pid " << runningPid() << endl;
+}
+
+/**
+ * Takes the service over from the one being upgraded, see upgradeService().
+ * The config is loaded while the old service still controls the fans, then
+ * it hands them over on manual mode and this one goes on from their state.
+ *
+ * Arguments are the descriptors inherited from the old service: the locked
+ * PID file, the upgrade command FIFO, the pipe telling the config is loaded
+ * and the one the fans are handed over on.
+ *
+ * @param  {int}          argc : Arguments count
+ * @param  {const char**} argv : Arguments
+ */
+void takeOverApp(int argc, char const *argv[]) {
+  struct stat lockSt, pidSt;
+  int         fds[4];
+
+  for (int i = 0; i < 4; i++) {
+    fds[i] = argc == 6 ? atoi(argv[i + 2]) : -1;
+    if (fds[i] >= 0) fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+  }
+
+  int lockFd = fds[0], readyFd = fds[1], loadedFd = fds[2], goFd = fds[3];
+
+  // Only run by an upgrading service, the one holding the PID file lock
+  if (lockFd < 0 || fstat(lockFd, &lockSt) < 0 ||
+      stat(PID_FILE.c_str(), &pidSt) < 0 || lockSt.st_ino != pidSt.st_ino ||
+      lockSt.st_dev != pidSt.st_dev || flock(lockFd, LOCK_EX | LOCK_NB) < 0) {
+    cout << "fanControl takeover is only run by fanControl upgrade" << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  try {
+    readConfig(fanController);
+    checkCalibrated(fanController);
+  } catch (const exception &e) {
+    startFailed(loadedFd, e.what());
+  }
+
+  sigset_t signals;
+
+  blockSignals(signals);
+
+  while (write(loadedFd, "ready\n", 6) < 0 && errno == EINTR)
+    ;
+  close(loadedFd);
+
+  // The old service sends "go" and the fans state, then exits
+  string handed = readPipe(goFd, STOP_TIMEOUT, true);
+
+  if (handed.compare(0, 3, "go\n") != 0)
+    startFailed(readyFd, "fanControl didn't hand the fans over");
+  close(goFd);
+
+  // The old service is gone, the fans go back to the firmware on failure
+  handed = handed.substr(3);
+
+  if (!writePid(lockFd, getpid())) {
+    fanController->giveBack(handed);
+    startFailed(readyFd, "Error writting file " + PID_FILE);
+  }
+
+  try {
+    fanController->setReadyFd(readyFd);
+    fanController->setStatePath(STATE_FILE);
+    fanController->startWorker(handed);
+  } catch (const exception &e) {
+    fanController->giveBack(handed);
+    startFailed(readyFd, e.what());
+  }
+
+  appLog("fanControl upgraded with pid " + to_string(getpid()));
+
+  serve(lockFd, signals);
 }
 
 // Starts the config wizard
 void configWizard() {
-  ShComm shell;
+  struct stat st;
 
   umask(007);
 
-  if (!shell.exec(LS_LA(APP_PATH))) mkdir(APP_PATH.c_str(), 0770);
+  if (stat(APP_PATH.c_str(), &st) < 0) mkdir(APP_PATH.c_str(), 0770);
 
   string title = "###############################"
                  " FanControl Configuration Mode "
@@ -265,12 +638,10 @@ void configWizard() {
 
 // Show service status
 void appStatus() {
-  ShComm shell;
+  pid_t pid = runningPid();
 
-  if (shell.exec(CAT(PID_FILE))) {
-    string pid = shell.firsLine();
-    shell.exec(CAT(USR_FILE));
-    string user = shell.firsLine();
+  if (pid != 0) {
+    string user = readFile(USR_FILE, true);
 
     cout << user << " is running an instance of fanControl with pid: " << pid
          << endl;
@@ -286,6 +657,8 @@ void showHelp() {
        << "      start     Starts fanControl" << endl
        << "      stop      Stops fanControl" << endl
        << "      restart   Restarts fanControl" << endl
+       << "      reload    Reloads fanControl config" << endl
+       << "      upgrade   Upgrades fanControl to the installed binary" << endl
        << "      config    Configuration wizard" << endl
        << "      status    Show fanControl status" << endl
        << "      help      Show this help" << endl
@@ -298,90 +671,196 @@ void showVers() {
        << fanControl_VERSION_MINOR << "." << fanControl_VERSION_PATCH << endl;
 }
 
-// Reads config file
-void readConfig(FanController *&fanCtl) {
-  ifstream    configFile(CFG_FILE);
-  fanNode_vp *fans = new fanNode_vp;
-  int         fansSize;
-  Sensor *    ambSensor = nullptr;
-  string      fansSizeStr, ambSensorType, ambSensorPath, ambSensorDevName,
-      ambSensorName, ambSensorMin, ambSensorMax, ambSensorOffset,
-      ambSensorCLabel;
+// Reads a sensor config values
+static SensorCfg readSensorCfg(ifstream &configFile) {
+  SensorCfg cfg;
+
+  getline(configFile, cfg.type);
+  getline(configFile, cfg.devName);
+  getline(configFile, cfg.path);
+  getline(configFile, cfg.name);
+  getline(configFile, cfg.minT);
+  getline(configFile, cfg.maxT);
+  getline(configFile, cfg.offsetT);
+  getline(configFile, cfg.cLabel);
+
+  return cfg;
+}
+
+// Sensors which labels are readed from sysfs, disks or hddtemp daemon
+static bool hasCachedLabel(int type) {
+  return type == Sensor::hwmon || type == Sensor::hddtemp ||
+         type == Sensor::hddtempd || type == Sensor::drivetemp ||
+         type == Sensor::thermal;
+}
+
+// Gets a cached setting, cached is cleared if it's missing
+static string getCached(map<string, string> &settings, string key,
+                        bool &cached) {
+  if (settings.count(key)) return settings[key];
+
+  cached = false;
+  return "";
+}
+
+// Builds a sensor from its config values, labels are taken from the cache
+static Sensor *buildSensor(const SensorCfg &cfg,
+                           map<string, string> &settings, bool &cached) {
+  int    type    = stoi(cfg.type);
+  int    minT    = stoi(cfg.minT);
+  int    maxT    = stoi(cfg.maxT);
+  int    offsetT = stoi(cfg.offsetT);
+  string label   = !hasCachedLabel(type)
+                     ? ""
+                     : getCached(settings, "sensorLabel." + cfg.path + cfg.name,
+                                 cached);
+
+  switch (type) { // clang-format off
+    case Sensor::hwmon:
+      return new HwMonSensor(cfg.devName, cfg.path, cfg.name, minT, maxT,
+                             offsetT, label, cfg.cLabel);
+    case Sensor::hddtempd:
+      return new HddTempDSensor(cfg.name, minT, maxT, offsetT, cfg.cLabel,
+                                cfg.path, label);
+    case Sensor::drivetemp:
+      return new DriveTempSensor(cfg.devName, cfg.path, minT, maxT, offsetT,
+                                 cfg.cLabel, label);
+    case Sensor::thermal:
+      return new ThermalZoneSensor(cfg.path, cfg.name, minT, maxT, offsetT,
+                                   cfg.cLabel, label);
+    case Sensor::ipmi:
+      return new IpmiSensor(cfg.name, minT, maxT, offsetT, cfg.cLabel,
+                            cfg.path);
+    case Sensor::exec:
+      return new ExecSensor(cfg.name, cfg.path, minT, maxT, offsetT,
+                            cfg.cLabel);
+    case Sensor::plugin:
+      return new PluginSensor(cfg.name, cfg.path, minT, maxT, offsetT,
+                              cfg.cLabel);
+    default:
+      return new HddTempSensor(cfg.name, minT, maxT, offsetT, cfg.cLabel,
+                               cfg.path, label);
+  } // clang-format on
+}
+
+// Builds a fan from its config values, labels and ranges are taken from the
+// cache
+static Fan *buildFan(const FanCfg &cfg, map<string, string> &settings,
+                     bool &cached) {
+  string key = cfg.path + cfg.name;
+
+  switch (stoi(cfg.type)) { // clang-format off
+    case Fan::hwmon: {
+      string label = getCached(settings, "fanLabel." + key, cached);
+      string range = getCached(settings, "fanRange." + key, cached);
+      int    minS  = -1, maxS = -1;
+
+      if (sscanf(range.c_str(), "%d %d", &minS, &maxS) != 2)
+        minS = maxS = -1;
+
+      return new HwMonFan(cfg.devName, cfg.path, cfg.name, cfg.cLabel, label,
+                          minS, maxS);
+    }
+    case Fan::pwm:
+      return new PwmFan(cfg.devName, cfg.path, cfg.name, cfg.cLabel,
+                        getCached(settings, "fanLabel." + key, cached));
+    case Fan::ipmi:
+      return new IpmiFan(cfg.name, cfg.path, cfg.cLabel);
+    case Fan::plugin:
+      return new PluginFan(cfg.name, cfg.path, cfg.cLabel);
+    default:
+      return nullptr;
+  } // clang-format on
+}
+
+// Writes a sensor config values
+static void writeSensorCfg(ofstream &configFile, const SensorCfg &cfg) {
+  configFile << cfg.type << endl
+             << cfg.devName << endl
+             << cfg.path << endl
+             << cfg.name << endl
+             << cfg.minT << endl
+             << cfg.maxT << endl
+             << cfg.offsetT << endl
+             << cfg.cLabel << endl;
+}
+
+// Gets a sensor config values, its label is added to the cached settings
+static SensorCfg sensorCfg(Sensor *sensor, map<string, string> &settings) {
+  SensorCfg cfg;
+
+  cfg.type    = to_string(sensor->type);
+  cfg.devName = sensor->getDevName();
+  cfg.path    = sensor->getPath();
+  cfg.name    = sensor->getName();
+  cfg.minT    = to_string(sensor->getMinT() / 1000);
+  cfg.maxT    = to_string(sensor->getMaxT() / 1000);
+  cfg.offsetT = to_string(sensor->getOffsetT() / 1000);
+  cfg.cLabel  = sensor->getCLabel();
+
+  if (hasCachedLabel(sensor->type))
+    settings["sensorLabel." + cfg.path + cfg.name] = sensor->getLabel();
+
+  return cfg;
+}
+
+// Parses the config file
+static void parseConfig(ControlPlan &plan) {
+  ifstream configFile(CFG_FILE);
+  string   fansSizeStr, setting;
 
   if (!configFile.is_open())
     throw runtime_error("Error opening config file " + CFG_FILE);
 
   getline(configFile, fansSizeStr);
-  fansSize = stoi(fansSizeStr);
+  plan.fans.resize(stoi(fansSizeStr));
 
-  for (int i = 0; i < fansSize; i++) {
-    Fan *             fan     = nullptr;
-    vector<Sensor *> *sensors = new vector<Sensor *>;
-    string fanType, fanDevName, fanPath, fanName, fanCLabel, sensorsSize;
+  for (unsigned int i = 0; i < plan.fans.size(); i++) {
+    FanCfg &fanCfg = plan.fans[i];
+    string  sensorsSize;
 
-    getline(configFile, fanType);
-    getline(configFile, fanDevName);
-    getline(configFile, fanPath);
-    getline(configFile, fanName);
-    getline(configFile, fanCLabel);
+    getline(configFile, fanCfg.type);
+    getline(configFile, fanCfg.devName);
+    getline(configFile, fanCfg.path);
+    getline(configFile, fanCfg.name);
+    getline(configFile, fanCfg.cLabel);
     getline(configFile, sensorsSize);
 
-    if (stoi(fanType) == Fan::hwmon)
-      fan = new HwMonFan(fanDevName, fanPath, fanName, fanCLabel);
-
-    for (int i = 0; i < stoi(sensorsSize); i++) {
-      string type, sensorDevName, sensorPath, sensorName, minT, maxT, offsetT,
-          sensorCLabel;
-
-      getline(configFile, type);
-      getline(configFile, sensorDevName);
-      getline(configFile, sensorPath);
-      getline(configFile, sensorName);
-      getline(configFile, minT);
-      getline(configFile, maxT);
-      getline(configFile, offsetT);
-      getline(configFile, sensorCLabel);
-
-      Sensor *sensor = nullptr;
-
-      if (stoi(type) == Sensor::hwmon)
-        sensor = new HwMonSensor(sensorDevName,
-                                 sensorPath,
-                                 sensorName,
-                                 stoi(minT),
-                                 stoi(maxT),
-                                 stoi(offsetT),
-                                 "",
-                                 sensorCLabel);
-      else
-        sensor = new HddTempSensor(sensorName,
-                                   stoi(minT),
-                                   stoi(maxT),
-                                   stoi(offsetT),
-                                   sensorCLabel,
-                                   sensorPath);
-
-      sensors->push_back(sensor);
-    }
-    fans->push_back(new FanNode(fan, sensors));
+    for (int j = 0; j < stoi(sensorsSize); j++)
+      fanCfg.sensors.push_back(readSensorCfg(configFile));
   }
 
-  getline(configFile, ambSensorType);
-  getline(configFile, ambSensorDevName);
-  getline(configFile, ambSensorPath);
-  getline(configFile, ambSensorName);
-  getline(configFile, ambSensorMin);
-  getline(configFile, ambSensorMax);
-  getline(configFile, ambSensorOffset);
-  getline(configFile, ambSensorCLabel);
+  plan.ambSensor = readSensorCfg(configFile);
+
+  // Optional settings, "key=value" lines after the ambient sensor
+  while (getline(configFile, setting)) {
+    size_t eq = setting.find('=');
+    if (eq != string::npos)
+      plan.settings[setting.substr(0, eq)] = setting.substr(eq + 1);
+  }
 
   configFile.close();
+}
+
+// Builds the fans controller of a plan, false if cached values are missing
+static bool buildController(FanController *&fanCtl, ControlPlan &plan) {
+  map<string, string> &settings  = plan.settings;
+  fanNode_vp *         fans      = new fanNode_vp;
+  Sensor *             ambSensor = nullptr;
+  bool                 cached    = true;
+
+  for (unsigned int i = 0; i < plan.fans.size(); i++) {
+    FanCfg &          fanCfg  = plan.fans[i];
+    Fan *             fan     = buildFan(fanCfg, settings, cached);
+    vector<Sensor *> *sensors = new vector<Sensor *>;
 
-  // clang-format off
-  ambSensor = new HwMonSensor(ambSensorDevName,ambSensorPath, ambSensorName, 
-                              stoi(ambSensorMin), stoi(ambSensorMax), 
-                              stoi(ambSensorOffset), "", ambSensorCLabel);
-  // clang-format on
+    for (unsigned int j = 0; j < fanCfg.sensors.size(); j++)
+      sensors->push_back(buildSensor(fanCfg.sensors[j], settings, cached));
+
+    fans->push_back(new FanNode(fan, sensors));
+  }
+
+  ambSensor = buildSensor(plan.ambSensor, settings, cached);
 
   if (fanCtl) {
     delete fanCtl;
@@ -389,58 +868,423 @@ void readConfig(FanController *&fanCtl) {
   }
 
   fanCtl = new FanController(ambSensor, fans);
+
+  // PWM fans calibration, "fanCalibration.<path><name>=<calibration>"
+  for (unsigned int i = 0; i < fans->size(); i++) {
+    Fan *  fan = (*fans)[i]->getFan();
+    string key = "fanCalibration." + fan->getPath() + fan->getName();
+
+    if (settings.count(key)) fan->setCalibration(settings[key]);
+  }
+
+  // IPMI fans raw commands, "ipmiSetSpeed.<name>" or for all "ipmiSetSpeed"
+  for (unsigned int i = 0; i < fans->size(); i++) {
+    IpmiFan *fan = dynamic_cast<IpmiFan *>((*fans)[i]->getFan());
+    string   cmds[3][2] = {{"ipmiManualOn", IpmiFan::MANUAL_ON},
+                           {"ipmiManualOff", IpmiFan::MANUAL_OFF},
+                           {"ipmiSetSpeed", IpmiFan::SET_SPEED}};
+
+    if (!fan) continue;
+
+    for (int j = 0; j < 3; j++) {
+      string key = cmds[j][0] + "." + fan->getName();
+
+      if (settings.count(key)) cmds[j][1] = settings[key];
+      else if (settings.count(cmds[j][0]))
+        cmds[j][1] = settings[cmds[j][0]];
+    }
+
+    // Saved by older versions as the default, each fan set all of them
+    if (cmds[2][1] == IpmiFan::SET_SPEED_ALL) cmds[2][1] = IpmiFan::SET_SPEED;
+
+    fan->setCommands(cmds[0][1], cmds[1][1], cmds[2][1]);
+  }
+
+  if (settings.count("diskSampleInterval"))
+    fanCtl->setSampleInterval(stoi(settings["diskSampleInterval"]) * 1000);
+  if (settings.count("diskStaleLimit"))
+    fanCtl->setStaleLimit(stoi(settings["diskStaleLimit"]) * 1000);
+
+  return cached;
+}
+
+// Checks if a path device identity is stored, or it doesn't need one
+static bool hasIdentity(ControlPlan &plan, string path) {
+  string dir = DeviceRegistry::hwmonDir(path);
+
+  return dir == "" || plan.settings.count("hwmonId." + dir) ||
+         access(dir.c_str(), F_OK) < 0;
+}
+
+// Moves a path to its device current hwmonN directory
+static string movePath(string path, map<string, string> &moved) {
+  string dir = DeviceRegistry::hwmonDir(path);
+
+  if (dir == "" || !moved.count(dir)) return path;
+
+  return moved[dir] + path.substr(dir.size());
+}
+
+/**
+ * Moves the plan devices which hwmonN directory changed, found by the
+ * "hwmonId.<dir>=<identity>" settings. Paths and settings keys are moved
+ * all at once, so devices swapping their numbers are moved right.
+ *
+ * @param  {ControlPlan&} plan : Parsed config
+ *
+ * @return {bool}              : False if the config should be written again,
+ *                               devices moved or have no identity stored
+ *
+ * @throws {runtime_error}     : If a device is not found, its old directory
+ *                               could be another chip
+ */
+static bool resolveDevices(ControlPlan &plan) {
+  map<string, string> moved, settings;
+  bool                current = true;
+
+  for (map<string, string>::iterator it = plan.settings.begin();
+       it != plan.settings.end(); it++) {
+    if (it->first.compare(0, 8, "hwmonId.") != 0) continue;
+
+    string dir = it->first.substr(8);
+    string now = DeviceRegistry::resolve(dir, it->second);
+
+    if (now == "")
+      throw runtime_error("hwmon device '" + it->second + "' not found, it " +
+                          "was " + dir + ". Run fanControl config if it " +
+                          "was removed");
+
+    if (now != dir) moved[dir] = now;
+  }
+
+  for (unsigned int i = 0; i < plan.fans.size(); i++) {
+    FanCfg &fanCfg = plan.fans[i];
+
+    current     = current && hasIdentity(plan, fanCfg.path);
+    fanCfg.path = movePath(fanCfg.path, moved);
+
+    for (unsigned int j = 0; j < fanCfg.sensors.size(); j++) {
+      SensorCfg &sensor = fanCfg.sensors[j];
+
+      current     = current && hasIdentity(plan, sensor.path);
+      sensor.path = movePath(sensor.path, moved);
+    }
+  }
+
+  current             = current && hasIdentity(plan, plan.ambSensor.path);
+  plan.ambSensor.path = movePath(plan.ambSensor.path, moved);
+
+  if (moved.empty()) return current;
+
+  for (map<string, string>::iterator it = plan.settings.begin();
+       it != plan.settings.end(); it++) {
+    size_t dot = it->first.find('.');
+    string key = dot == string::npos
+                     ? it->first
+                     : it->first.substr(0, dot + 1) +
+                           movePath(it->first.substr(dot + 1), moved);
+
+    settings[key] = it->second;
+  }
+
+  plan.settings = settings;
+
+  return false;
+}
+
+// Stores a hwmonN directory identity on the cached settings
+static void cacheIdentity(map<string, string> &settings, string path) {
+  string dir = DeviceRegistry::hwmonDir(path);
+  string id  = dir == "" ? "" : DeviceRegistry::identity(dir);
+
+  if (id != "") settings["hwmonId." + dir] = id;
 }
 
-// Writes config file
+// Gets the plan of a fans controller, as the config stores it
+static void planController(FanController *fanCtl, ControlPlan &plan) {
+  fanNode_vp           fans     = *fanCtl->getFans();
+  map<string, string> &settings = plan.settings;
+
+  for (unsigned int i = 0; i < fans.size(); i++) {
+    Fan *             fan     = fans[i]->getFan();
+    vector<Sensor *> *sensors = fans[i]->getSensors();
+    IpmiFan *         ipmiFan = dynamic_cast<IpmiFan *>(fan);
+    string            key     = fan->getPath() + fan->getName();
+    FanCfg            fanCfg;
+
+    fanCfg.type    = to_string(fan->type);
+    fanCfg.devName = fan->getDevName();
+    fanCfg.path    = fan->getPath();
+    fanCfg.name    = fan->getName();
+    fanCfg.cLabel  = fan->getCLabel();
+
+    for (unsigned int j = 0; j < sensors->size(); j++) {
+      fanCfg.sensors.push_back(sensorCfg((*sensors)[j], settings));
+      cacheIdentity(settings, fanCfg.sensors[j].path);
+    }
+    cacheIdentity(settings, fanCfg.path);
+
+    plan.fans.push_back(fanCfg);
+
+    if (fan->getCalibration() != "")
+      settings["fanCalibration." + key] = fan->getCalibration();
+
+    // Devices labels and fans ranges, so starting doesn't probe them again
+    if (fan->type == Fan::hwmon || fan->type == Fan::pwm)
+      settings["fanLabel." + key] = fan->getLabel();
+    if (fan->type == Fan::hwmon)
+      settings["fanRange." + key] =
+          to_string(fan->getMinS()) + " " + to_string(fan->getMaxS());
+
+    if (ipmiFan) {
+      settings["ipmiManualOn." + fan->getName()]  = ipmiFan->getManualOnCmd();
+      settings["ipmiManualOff." + fan->getName()] = ipmiFan->getManualOffCmd();
+      settings["ipmiSetSpeed." + fan->getName()]  = ipmiFan->getSpeedCmd();
+    }
+  }
+
+  plan.ambSensor = sensorCfg(fanCtl->getAmbSensor(), settings);
+  cacheIdentity(settings, plan.ambSensor.path);
+
+  settings["diskSampleInterval"] =
+      to_string(fanCtl->getSampleInterval() / 1000);
+  settings["diskStaleLimit"] = to_string(fanCtl->getStaleLimit() / 1000);
+}
+
+/**
+ * Reads config file. The plan saved with the config is used while it's
+ * valid, otherwise the whole file is parsed before building the devices, so
+ * the labels and fan ranges cached on the settings avoid probing every
+ * device again. Missing ones are readed from the devices. hwmon devices
+ * numbered in another order are found by their stored identity.
+ *
+ * @param  {FanController*&} fanCtl : Where to store the new controller
+ *
+ * @return {bool}                   : False if the cached values are missing
+ *                                    or devices moved, and the config should
+ *                                    be written again
+ */
+bool readConfig(FanController *&fanCtl) {
+  ControlPlan plan;
+  bool        planned = plan.load(PLAN_FILE, CFG_FILE);
+  bool        current = true, cached;
+
+  // Plans are only valid for the same hwmon devices, no need to resolve them
+  if (!planned) {
+    parseConfig(plan);
+    current = resolveDevices(plan);
+  }
+
+  cached = buildController(fanCtl, plan) && current;
+
+  // Plans are only saved fully resolved
+  if (!planned && cached) plan.save(PLAN_FILE, CFG_FILE);
+
+  return cached;
+}
+
+// Writes config file and its plan
 void writeConfig(FanController *fanCtl) {
-  ofstream   configFile(CFG_FILE);
-  fanNode_vp fans      = *fanCtl->getFans();
-  int        fansSize  = fans.size();
-  Sensor *   ambSensor = fanCtl->getAmbSensor();
+  ofstream    configFile(CFG_FILE);
+  ControlPlan plan;
 
   umask(007);
 
   if (!configFile.is_open())
     throw runtime_error("Error opening config file " + CFG_FILE);
 
-  configFile << fansSize << endl;
-
-  for (int i = 0; i < fansSize; i++) {
-    Fan *             fan         = fans[i]->getFan();
-    vector<Sensor *> *sensors     = fans[i]->getSensors();
-    int               sensorsSize = sensors->size();
-
-    configFile << fan->type << endl
-               << fan->getDevName() << endl
-               << fan->getPath() << endl
-               << fan->getName() << endl
-               << fan->getCLabel() << endl
-               << sensorsSize << endl;
-
-    for (int i = 0; i < sensorsSize; i++) {
-      Sensor *sensor = (*sensors)[i];
-
-      configFile << sensor->type << endl
-                 << sensor->getDevName() << endl
-                 << sensor->getPath() << endl
-                 << sensor->getName() << endl
-                 << sensor->getMinT() / 1000 << endl
-                 << sensor->getMaxT() / 1000 << endl
-                 << sensor->getOffsetT() / 1000 << endl
-                 << sensor->getCLabel() << endl;
-    }
+  planController(fanCtl, plan);
+
+  configFile << plan.fans.size() << endl;
+
+  for (unsigned int i = 0; i < plan.fans.size(); i++) {
+    FanCfg &fanCfg = plan.fans[i];
+
+    configFile << fanCfg.type << endl
+               << fanCfg.devName << endl
+               << fanCfg.path << endl
+               << fanCfg.name << endl
+               << fanCfg.cLabel << endl
+               << fanCfg.sensors.size() << endl;
+
+    for (unsigned int j = 0; j < fanCfg.sensors.size(); j++)
+      writeSensorCfg(configFile, fanCfg.sensors[j]);
   }
 
-  configFile << ambSensor->type << endl
-             << ambSensor->getDevName() << endl
-             << ambSensor->getPath() << endl
-             << ambSensor->getName() << endl
-             << ambSensor->getMinT() / 1000 << endl
-             << ambSensor->getMaxT() / 1000 << endl
-             << ambSensor->getOffsetT() / 1000 << endl
-             << ambSensor->getCLabel() << endl;
+  writeSensorCfg(configFile, plan.ambSensor);
+
+  for (map<string, string>::iterator it = plan.settings.begin();
+       it != plan.settings.end(); it++)
+    configFile << it->first << "=" << it->second << endl;
 
   configFile.close();
+
+  // Saved after the config, the plan stores its fingerprint
+  plan.save(PLAN_FILE, CFG_FILE);
+}
+
+/**
+ * Reloads the config on the running service. The new controller is built
+ * while the fans are still controlled and swapped in between two ticks, the
+ * fans never go back to the firmware. A config that can't be loaded is
+ * logged and the current one is kept, like one with fans to calibrate, the
+ * calibration sweep needs a restart.
+ */
+void reloadConfig() {
+  FanController *next = nullptr;
+
+  try {
+    bool cached = readConfig(next);
+
+    checkCalibrated(next);
+    if (!cached) writeConfig(next);
+
+    fanController->reload(next);
+    appLog("fanControl config reloaded");
+  } catch (const exception &e) {
+    crashLog("Cannot reload fanControl config: " + string(e.what()));
+  }
+
+  // The old fans and sensors, removed fans go back to automatic mode
+  if (next) {
+    next->clearAll();
+    delete next;
+  }
+}
+
+// Moves a descriptor above the standard ones, they are closed on the service
+static int aboveStd(int fd) {
+  if (fd < 0 || fd > STDERR_FILENO) return fd;
+
+  int moved = fcntl(fd, F_DUPFD_CLOEXEC, STDERR_FILENO + 1);
+
+  close(fd);
+  return moved;
+}
+
+// Upgrade failure, the service goes on and the upgrade command is told
+static void upgradeFailed(int readyFd, string eMsg) {
+  string msg = "error " + eMsg + "\n";
+
+  crashLog("Cannot upgrade fanControl: " + eMsg);
+  while (write(readyFd, msg.c_str(), msg.size()) < 0 && errno == EINTR)
+    ;
+  close(readyFd);
+}
+
+/**
+ * Upgrades the running service to the installed binary without giving the
+ * fans back to the firmware. It's started with "takeover" and loads the
+ * config while this service still controls the fans, then this one stops
+ * its worker leaving the fans on manual mode, sends their state and exits.
+ * If the new service can't load the config or take the fans this one goes
+ * on.
+ *
+ * The new service inherits the PID file lock, so there's always one holding
+ * it, the upgrade command FIFO, a "loaded" pipe to tell the config is loaded
+ * and a "go" pipe to wait for the fans, "go" and their state until EOF.
+ *
+ * @param  {int} lockFd : Locked PID file descriptor
+ */
+void upgradeService(int lockFd) {
+  int   readyFd, loaded[2] = {-1, -1}, go[2] = {-1, -1};
+  pid_t pid = -1;
+
+  readyFd = open(UPG_FIFO.c_str(), O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+  if ((readyFd = aboveStd(readyFd)) < 0) {
+    crashLog("Cannot upgrade fanControl, no upgrade command waiting");
+    return;
+  }
+
+  if (pipe2(loaded, O_CLOEXEC) == 0 && pipe2(go, O_CLOEXEC) == 0) {
+    for (int i = 0; i < 2; i++) {
+      loaded[i] = aboveStd(loaded[i]);
+      go[i]     = aboveStd(go[i]);
+    }
+
+    // Only async-signal-safe calls on the child, other threads are running
+    string      fds[4] = {to_string(lockFd), to_string(readyFd),
+                     to_string(loaded[1]), to_string(go[0])};
+    const char *argv[] = {"fanControl",    "takeover",     fds[0].c_str(),
+                          fds[1].c_str(), fds[2].c_str(), fds[3].c_str(),
+                          nullptr};
+    int         null   = open("/dev/null", O_RDWR | O_CLOEXEC);
+
+    if (null >= 0 && (pid = fork()) == 0) {
+      for (int fd = STDIN_FILENO; fd <= STDERR_FILENO; fd++) dup2(null, fd);
+
+      fcntl(lockFd, F_SETFD, 0);
+      fcntl(readyFd, F_SETFD, 0);
+      fcntl(loaded[1], F_SETFD, 0);
+      fcntl(go[0], F_SETFD, 0);
+
+      execv(FANCONTROL_BIN, (char *const *)argv);
+      _exit(EXIT_FAILURE);
+    }
+
+    if (null >= 0) close(null);
+  }
+
+  if (loaded[1] >= 0) close(loaded[1]);
+  if (go[0] >= 0) close(go[0]);
+
+  string msg = pid > 0 ? waitReady(loaded[0], START_TIMEOUT) : "";
+
+  if (loaded[0] >= 0) close(loaded[0]);
+
+  if (msg != "ready") {
+    if (pid > 0) {
+      kill(pid, SIGKILL);
+      waitpid(pid, nullptr, 0);
+    }
+    if (go[1] >= 0) close(go[1]);
+
+    upgradeFailed(readyFd,
+                  msg.compare(0, 6, "error ") == 0
+                      ? msg.substr(6)
+                      : "Cannot start " + string(FANCONTROL_BIN));
+    return;
+  }
+
+  string handed = "go\n" + fanController->handOver();
+
+  // A new service gone meanwhile is an EPIPE, not a signal killing this one
+  void (*pipeAction)(int) = signal(SIGPIPE, SIG_IGN);
+  bool sent = writeAll(go[1], handed.data(), handed.size());
+
+  signal(SIGPIPE, pipeAction);
+  close(go[1]);
+
+  if (!sent) {
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+
+    // The fans are still on manual mode, this service goes on with them
+    fanController->startWorker();
+    upgradeFailed(readyFd, "Cannot hand the fans over");
+    return;
+  }
+
+  // The new service tells the upgrade command when it controls the fans
+  close(readyFd);
+  appLog("fanControl handed over to pid " + to_string(pid));
+
+  // Fans stay on manual mode, the PID file and its lock go to the new one
+  exit(EXIT_SUCCESS);
+}
+
+// Calibrates a fan if it needs it
+bool calibrateFan(Fan *fan) {
+  if (fan->isCalibrated()) return true;
+
+  cout << "Calibrating " << fan->getCLabel()
+       << " fan, it takes about a minute..." << endl;
+
+  bool calibrated = fan->calibrate();
+
+  if (calibrated) appLog("Fan " + fan->getCLabel() + " calibrated");
+
+  return calibrated;
 }
 
 string logMsg(string msg) {
@@ -462,6 +1306,10 @@ void crashLog(string msg) { appendFile(CRASH_LOG, logMsg(msg)); }
 void signHandler(int sigN) {
   if (fanController && fanController->getWorker()) fanController->stopWorker();
 
+  // Fans are back on automatic mode, the PID file lock goes with the exit
+  unlink(USR_FILE.c_str());
+  unlink(PID_FILE.c_str());
+
   appLog("fanControl stopped");
 
   exit(EXIT_SUCCESS);
@@ -25,18 +25,30 @@ using namespace std;
  * Aplication globals
  ******************************************************************************/
 
-extern const string APP_USER;  // User running the app
-extern const string HOME_PATH; // User home
-extern const string APP_PATH;  // User app folder
-extern const string CFG_FILE;  // User app config file
-extern const string LOG_FILE;  // User app log file
-extern const string CRASH_LOG; // User app crashlog file
-extern const string VAR_DIR;   // Var directory
-extern const string PID_FILE;  // Service PID
-extern const string USR_FILE;  // User running service
-
-void readConfig(FanController *&fanCtl); // Reads config file
+extern const string APP_USER;   // User running the app
+extern const string HOME_PATH;  // User home
+extern const string APP_PATH;   // User app folder
+extern const string CFG_FILE;   // User app config file
+extern const string PLAN_FILE;  // User app config resolved plan
+extern const string STATE_FILE; // User app controller last state
+extern const string LOG_FILE;   // User app log file
+extern const string CRASH_LOG;  // User app crashlog file
+extern const string EXEC_DIR;   // External sensors helpers
+extern const string PLUGIN_DIR; // Backend plugins
+extern const string VAR_DIR;    // Var directory
+extern const string PID_FILE;   // Service PID
+extern const string USR_FILE;   // User running service
+extern const string UPG_FIFO;   // Upgrade command readiness FIFO
+
+const int START_TIMEOUT   = 9000;  // Milliseconds waiting the service start
+const int STOP_TIMEOUT    = 9000;  // Milliseconds waiting the service stop
+const int UPGRADE_TIMEOUT = 18000; // Milliseconds waiting the service upgrade
+
+bool readConfig(FanController *&fanCtl); // Reads config file
 void writeConfig(FanController *fanCtl); // Writes config file
+bool calibrateFan(Fan *fan);             // Calibrates a fan if it needs it
+void reloadConfig();                     // Reloads config on the service
+void upgradeService(int lockFd);         // Hands the service over
 
 /******************************************************************************
  * Aplication commands
@@ -48,6 +60,9 @@ enum appCommands {
   start,      // Start fan control worker
   stop,       // Stop fan control worker
   restart,    // Restart fan control worker
+  reload,     // Reload fan control config
+  upgrade,    // Upgrade fan control service
+  takeover,   // Take fan control service over, run by upgrade
   status,     // Show fan control status
   config,     // Config wizard mode
   help,       // Show fan control help
@@ -63,6 +78,11 @@ extern map<string, int> commands;
 void startApp();     // Starts fanControl service
 void stopApp();      // Stops fanControl service
 void restartApp();   // Restarts fanControl service
+void reloadApp();    // Reloads fanControl service config
+void upgradeApp();   // Upgrades fanControl service
+
+// Takes fanControl service over, started by the upgrading one
+void takeOverApp(int argc, char const *argv[]);
 void configWizard(); // Starts the config wizard
 void appStatus();    // Show service status
 void showHelp();     // Show help commands